@@ -0,0 +1,114 @@
+#include "backend_memory.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static const uint32_t color_values[COLOR_COUNT] = {
+    0x000000,  // COLOR_BACKGROUND
+    0xFFFFFF,  // COLOR_LINE
+    0xFFFFFF,  // COLOR_HIGHLIGHT
+    0xFFFF00,  // COLOR_LABEL
+    0x333333,  // COLOR_SUBCELL_LABEL
+};
+
+MemoryBackend::MemoryBackend(int width, int height, bool raster)
+    : width_(width), height_(height), raster_(raster) {
+    if (raster_) {
+        grid_.assign((size_t)width * height, 0);
+        window_.assign((size_t)width * height, 0);
+    }
+}
+
+const std::vector<uint32_t>& MemoryBackend::pixels(Surface surface) const {
+    return surface == SURFACE_GRID ? grid_ : window_;
+}
+
+int MemoryBackend::text_width(const char* text, int len) {
+    (void)text;
+    return len * char_width;
+}
+
+int MemoryBackend::text_ascent() {
+    return ascent;
+}
+
+int MemoryBackend::text_descent() {
+    return descent;
+}
+
+// Mirrors the X11 backend, which only changes the GC foreground when needed.
+void MemoryBackend::use_color(Color color) {
+    if (current_color_ != color) {
+        counters.requests++;
+        current_color_ = color;
+    }
+}
+
+void MemoryBackend::fill(Surface target, int x, int y, int w, int h, uint32_t value) {
+    int x0 = std::max(0, x), y0 = std::max(0, y);
+    int x1 = std::min(width_, x + w), y1 = std::min(height_, y + h);
+    if (x0 >= x1 || y0 >= y1) return;
+    std::vector<uint32_t>& buf = target == SURFACE_GRID ? grid_ : window_;
+    for (int row = y0; row < y1; ++row) {
+        std::fill_n(&buf[(size_t)row * width_ + x0], x1 - x0, value);
+    }
+}
+
+void MemoryBackend::fill_rects(Surface target, Color color, const Rect* rects, int count) {
+    if (count == 0) return;
+    use_color(color);
+    counters.requests++;
+    counters.rects += count;
+    if (!raster_) return;
+    for (int i = 0; i < count; ++i) {
+        fill(target, rects[i].x, rects[i].y, rects[i].width, rects[i].height, color_values[color]);
+    }
+}
+
+// Only the axis-aligned segments the grid uses are rasterized.
+void MemoryBackend::draw_segments(Surface target, Color color, const Segment* segments, int count) {
+    if (count == 0) return;
+    use_color(color);
+    counters.requests++;
+    counters.segments += count;
+    if (!raster_) return;
+    for (int i = 0; i < count; ++i) {
+        const Segment& s = segments[i];
+        if (s.x1 == s.x2) {
+            fill(target, s.x1, std::min(s.y1, s.y2), 1, std::abs(s.y2 - s.y1) + 1, color_values[color]);
+        } else if (s.y1 == s.y2) {
+            fill(target, std::min(s.x1, s.x2), s.y1, std::abs(s.x2 - s.x1) + 1, 1, color_values[color]);
+        }
+    }
+}
+
+void MemoryBackend::draw_text_row(Surface target, Color color, int baseline,
+                                  const TextItem* items, int count) {
+    if (count == 0) return;
+    use_color(color);
+    counters.requests++;
+    for (int i = 0; i < count; ++i) {
+        counters.glyphs += items[i].len;
+        if (!raster_) continue;
+        for (int c = 0; c < items[i].len; ++c) {
+            fill(target, items[i].x + c * char_width, baseline - ascent,
+                 char_width - 1, ascent + descent, color_values[color]);
+        }
+    }
+}
+
+void MemoryBackend::copy_area(Surface from, Surface to, const Rect& area) {
+    counters.requests++;
+    int x0 = std::max(0, area.x), y0 = std::max(0, area.y);
+    int x1 = std::min(width_, area.x + area.width), y1 = std::min(height_, area.y + area.height);
+    if (x0 >= x1 || y0 >= y1) return;
+    counters.copied_pixels += (long)(x1 - x0) * (y1 - y0);
+    if (!raster_ || from == to) return;
+    const std::vector<uint32_t>& src = from == SURFACE_GRID ? grid_ : window_;
+    std::vector<uint32_t>& dst = to == SURFACE_GRID ? grid_ : window_;
+    for (int row = y0; row < y1; ++row) {
+        size_t offset = (size_t)row * width_ + x0;
+        std::memcpy(&dst[offset], &src[offset], (x1 - x0) * sizeof(uint32_t));
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef STRIX_BACKEND_MEMORY_H
+#define STRIX_BACKEND_MEMORY_H
+
+#include "render.h"
+
+#include <cstdint>
+#include <vector>
+
+// Offscreen backend for benchmarks. It counts the requests an X11 backend
+// would send and, with raster enabled, also draws into 32-bit buffers so the
+// pixel work is measured too. Text uses the metrics of the X "fixed" font and
+// is drawn as solid glyph boxes.
+class MemoryBackend : public RenderBackend {
+public:
+    struct Counters {
+        long requests = 0;       // drawing requests, including foreground changes
+        long rects = 0;
+        long segments = 0;
+        long glyphs = 0;
+        long copied_pixels = 0;
+    };
+
+    static const int char_width = 6;
+    static const int ascent = 11;
+    static const int descent = 2;
+
+    MemoryBackend(int width, int height, bool raster);
+
+    Counters counters;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    const std::vector<uint32_t>& pixels(Surface surface) const;
+
+    int text_width(const char* text, int len) override;
+    int text_ascent() override;
+    int text_descent() override;
+
+    void fill_rects(Surface target, Color color, const Rect* rects, int count) override;
+    void draw_segments(Surface target, Color color, const Segment* segments, int count) override;
+    void draw_text_row(Surface target, Color color, int baseline,
+                       const TextItem* items, int count) override;
+    void copy_area(Surface from, Surface to, const Rect& area) override;
+
+private:
+    void use_color(Color color);
+    void fill(Surface target, int x, int y, int w, int h, uint32_t value);
+
+    int width_;
+    int height_;
+    bool raster_;
+    int current_color_ = -1;
+    std::vector<uint32_t> grid_;
+    std::vector<uint32_t> window_;
+};
+
+#endif
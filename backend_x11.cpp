@@ -0,0 +1,239 @@
+#include "backend_x11.h"
+
+#include <algorithm>
+
+X11Backend::X11Backend(Display* display, XFontStruct* font, XftFont* xft_font)
+    : display_(display), font_(font), xft_(xft_font) {
+    if (!xft_) return;
+
+    int screen = DefaultScreen(display_);
+    format_ = XRenderFindVisualFormat(display_, DefaultVisual(display_, screen));
+
+    // Upload every printable ASCII glyph now, in one batch, so drawing never
+    // has to add glyphs to the server's glyph set.
+    FT_UInt printable[128];
+    int count = 0;
+    for (int c = ' '; c < 127; ++c) {
+        glyphs_[c] = XftCharIndex(display_, xft_, c);
+        XGlyphInfo extents;
+        XftGlyphExtents(display_, xft_, &glyphs_[c], 1, &extents);
+        advances_[c] = extents.xOff;
+        printable[count++] = glyphs_[c];
+    }
+    XftFontLoadGlyphs(display_, xft_, FcTrue, printable, count);
+}
+
+X11Backend::~X11Backend() {
+    unbind();
+    for (Picture fill : fills_) {
+        if (fill) XRenderFreePicture(display_, fill);
+    }
+    for (Picture picture : slot_pictures_) {
+        if (picture) XRenderFreePicture(display_, picture);
+    }
+    for (Pixmap pixmap : slots_) XFreePixmap(display_, pixmap);
+}
+
+void X11Backend::set_color(Color color, unsigned long pixel, uint32_t rgb) {
+    pixels_[color] = pixel;
+    gc_color_ = -1;
+    if (!xft_) return;
+
+    XRenderColor fill = {(unsigned short)((rgb >> 16 & 0xff) * 0x101),
+                         (unsigned short)((rgb >> 8 & 0xff) * 0x101),
+                         (unsigned short)((rgb & 0xff) * 0x101), 0xffff};
+    if (fills_[color]) XRenderFreePicture(display_, fills_[color]);
+    fills_[color] = XRenderCreateSolidFill(display_, &fill);
+}
+
+void X11Backend::bind(Window window, Pixmap grid, Pixmap back, GC gc) {
+    unbind();
+    window_ = window;
+    grid_ = grid;
+    back_ = back;
+    gc_ = gc;
+    gc_color_ = -1;
+    damage_ = {};
+    if (xft_) {
+        back_picture_ = XRenderCreatePicture(display_, back_, format_, 0, nullptr);
+        grid_picture_ = XRenderCreatePicture(display_, grid_, format_, 0, nullptr);
+    }
+}
+
+void X11Backend::unbind() {
+    if (back_picture_) XRenderFreePicture(display_, back_picture_);
+    if (grid_picture_) XRenderFreePicture(display_, grid_picture_);
+    back_picture_ = 0;
+    grid_picture_ = 0;
+    window_ = 0;
+    grid_ = 0;
+    back_ = 0;
+}
+
+void X11Backend::present() {
+    if (damage_.width == 0) return;
+    XCopyArea(display_, back_, window_, gc_, damage_.x, damage_.y, damage_.width, damage_.height,
+              damage_.x, damage_.y);
+    damage_ = {};
+}
+
+void X11Backend::expose(const Rect& area) {
+    XCopyArea(display_, back_, window_, gc_, area.x, area.y, area.width, area.height,
+              area.x, area.y);
+}
+
+void X11Backend::reset_frame(int width, int height) {
+    XCopyArea(display_, grid_, back_, gc_, 0, 0, width, height, 0, 0);
+    damage_ = {};
+}
+
+void X11Backend::begin_slot(int slot, const Rect& area) {
+    while ((int)slots_.size() <= slot) {
+        int screen = DefaultScreen(display_);
+        Pixmap pixmap = XCreatePixmap(display_, RootWindow(display_, screen), area.width, area.height,
+                                      DefaultDepth(display_, screen));
+        slots_.push_back(pixmap);
+        slot_pictures_.push_back(xft_ ? XRenderCreatePicture(display_, pixmap, format_, 0, nullptr) : 0);
+    }
+    slot_ = slot;
+    slot_x_ = area.x;
+    slot_y_ = area.y;
+}
+
+void X11Backend::end_slot() {
+    slot_ = -1;
+    slot_x_ = 0;
+    slot_y_ = 0;
+}
+
+void X11Backend::copy_from_slot(int slot, const Rect& area) {
+    add_damage(SURFACE_WINDOW, area.x, area.y, area.x + area.width, area.y + area.height);
+    XCopyArea(display_, slots_[slot], back_, gc_, 0, 0, area.width, area.height, area.x, area.y);
+}
+
+int X11Backend::text_width(const char* text, int len) {
+    if (xft_) {
+        int width = 0;
+        for (int i = 0; i < len; ++i) width += advances_[text[i] & 0x7f];
+        return width;
+    }
+    return font_ ? XTextWidth(font_, text, len) : 0;
+}
+
+int X11Backend::text_ascent() {
+    if (xft_) return xft_->ascent;
+    return font_ ? font_->ascent : 0;
+}
+
+int X11Backend::text_descent() {
+    if (xft_) return xft_->descent;
+    return font_ ? font_->descent : 0;
+}
+
+// Everything aimed at the window lands in the back buffer, or a slot.
+Drawable X11Backend::drawable(Surface surface) const {
+    if (surface == SURFACE_GRID) return grid_;
+    return slot_ == -1 ? back_ : slots_[slot_];
+}
+
+// Grow the area present() copies by the bounds [x0, x1) x [y0, y1) of a
+// request. Updates touch one cell or a few neighbours, so a single bounding
+// box costs little extra copying and keeps present() to one request.
+void X11Backend::add_damage(Surface target, int x0, int y0, int x1, int y1) {
+    if (target != SURFACE_WINDOW || slot_ != -1 || x1 <= x0 || y1 <= y0) return;
+    if (damage_.width > 0) {
+        x0 = std::min(x0, damage_.x);
+        y0 = std::min(y0, damage_.y);
+        x1 = std::max(x1, damage_.x + damage_.width);
+        y1 = std::max(y1, damage_.y + damage_.height);
+    }
+    damage_ = {x0, y0, x1 - x0, y1 - y0};
+}
+
+// Skip the ChangeGC request when the foreground is already right.
+void X11Backend::use_color(Color color) {
+    if (gc_color_ != color) {
+        XSetForeground(display_, gc_, pixels_[color]);
+        gc_color_ = color;
+    }
+}
+
+void X11Backend::fill_rects(Surface target, Color color, const Rect* rects, int count) {
+    if (count == 0) return;
+    rects_.clear();
+    for (int i = 0; i < count; ++i) {
+        rects_.push_back({(short)(rects[i].x - dx(target)), (short)(rects[i].y - dy(target)),
+                          (unsigned short)rects[i].width, (unsigned short)rects[i].height});
+        add_damage(target, rects[i].x, rects[i].y,
+                   rects[i].x + rects[i].width, rects[i].y + rects[i].height);
+    }
+    use_color(color);
+    XFillRectangles(display_, drawable(target), gc_, rects_.data(), count);
+}
+
+void X11Backend::draw_segments(Surface target, Color color, const Segment* segments, int count) {
+    if (count == 0) return;
+    segments_.clear();
+    for (int i = 0; i < count; ++i) {
+        const Segment& s = segments[i];
+        segments_.push_back({(short)(s.x1 - dx(target)), (short)(s.y1 - dy(target)),
+                             (short)(s.x2 - dx(target)), (short)(s.y2 - dy(target))});
+        add_damage(target, std::min(s.x1, s.x2), std::min(s.y1, s.y2),
+                   std::max(s.x1, s.x2) + 1, std::max(s.y1, s.y2) + 1);
+    }
+    use_color(color);
+    XDrawSegments(display_, drawable(target), gc_, segments_.data(), count);
+}
+
+// One PolyText request per row: each item's delta moves the pen from the end
+// of the previous label to the start of this one.
+void X11Backend::draw_text_row(Surface target, Color color, int baseline,
+                               const TextItem* items, int count) {
+    if (count == 0) return;
+    const TextItem& last = items[count - 1];
+    add_damage(target, items[0].x, baseline - text_ascent(),
+               last.x + text_width(last.chars, last.len), baseline + text_descent());
+    if (xft_) {
+        draw_glyph_row(target, color, baseline, items, count);
+        return;
+    }
+    items_.clear();
+    int pen_x = items[0].x;
+    for (int i = 0; i < count; ++i) {
+        XTextItem item;
+        item.chars = const_cast<char*>(items[i].chars);
+        item.nchars = items[i].len;
+        item.delta = items[i].x - pen_x;
+        item.font = None;
+        items_.push_back(item);
+        pen_x = items[i].x + text_width(items[i].chars, items[i].len);
+    }
+    use_color(color);
+    XDrawText(display_, drawable(target), gc_, items[0].x - dx(target), baseline - dy(target),
+              items_.data(), count);
+}
+
+// Antialiased labels: every glyph of the row is positioned explicitly and
+// composited from the glyph set in one request.
+void X11Backend::draw_glyph_row(Surface target, Color color, int baseline,
+                                const TextItem* items, int count) {
+    glyph_specs_.clear();
+    for (int i = 0; i < count; ++i) {
+        int pen_x = items[i].x - dx(target);
+        for (int j = 0; j < items[i].len; ++j) {
+            int c = items[i].chars[j] & 0x7f;
+            glyph_specs_.push_back({glyphs_[c], (short)pen_x, (short)(baseline - dy(target))});
+            pen_x += advances_[c];
+        }
+    }
+    Picture dst = target == SURFACE_GRID ? grid_picture_
+                  : slot_ == -1 ? back_picture_ : slot_pictures_[slot_];
+    XftGlyphSpecRender(display_, PictOpOver, fills_[color], xft_, dst, 0, 0,
+                       glyph_specs_.data(), (int)glyph_specs_.size());
+}
+
+void X11Backend::copy_area(Surface from, Surface to, const Rect& area) {
+    add_damage(to, area.x, area.y, area.x + area.width, area.y + area.height);
+    XCopyArea(display_, drawable(from), drawable(to), gc_, area.x - dx(from), area.y - dy(from),
+              area.width, area.height, area.x - dx(to), area.y - dy(to));
+}
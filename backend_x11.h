@@ -0,0 +1,101 @@
+#ifndef STRIX_BACKEND_X11_H
+#define STRIX_BACKEND_X11_H
+
+#include "render.h"
+
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+#include <cstdint>
+#include <vector>
+
+// Draws into the overlay's grid pixmap and its back buffer with core X
+// requests. SURFACE_WINDOW is the back buffer: the window itself only changes
+// when present() copies a finished frame into it, so the compositor never
+// sees a half-drawn update. With an Xft font, labels are composited from the
+// font's server-side glyph set instead: the glyphs labels can use are
+// uploaded once up front, and a text row is a single RenderCompositeGlyphs
+// request.
+class X11Backend : public RenderBackend {
+public:
+    // Exactly one of font and xft_font is used; xft_font wins if both are set.
+    X11Backend(Display* display, XFontStruct* font, XftFont* xft_font);
+    ~X11Backend() override;
+
+    // pixel draws with core requests; rgb (0xRRGGBB) is the same colour for
+    // XRender, so no colormap lookup is needed.
+    void set_color(Color color, unsigned long pixel, uint32_t rgb);
+
+    // Target a new overlay window, grid pixmap, back buffer and GC; called on
+    // every create. The back buffer must start out as a copy of the grid.
+    void bind(Window window, Pixmap grid, Pixmap back, GC gc);
+    // Let go of the window and pixmaps before they are destroyed.
+    void unbind();
+
+    // Whether anything was drawn since the last present().
+    bool frame_pending() const { return damage_.width > 0; }
+    // Copy everything drawn since the last call to the window, as one request.
+    void present();
+    // Copy part of the current frame to the window again, e.g. on Expose.
+    void expose(const Rect& area);
+    // Start the next frame from the plain grid, without touching the window.
+    void reset_frame(int width, int height);
+
+    // Numbered off-screen images of single cells. Between begin_slot and
+    // end_slot, drawing aimed at SURFACE_WINDOW goes into the slot instead,
+    // with area's corner as the slot's origin. Slots are created on first use.
+    void begin_slot(int slot, const Rect& area);
+    void end_slot();
+    // Copy a slot into the frame at area, like any other window drawing.
+    void copy_from_slot(int slot, const Rect& area);
+
+    int text_width(const char* text, int len) override;
+    int text_ascent() override;
+    int text_descent() override;
+
+    void fill_rects(Surface target, Color color, const Rect* rects, int count) override;
+    void draw_segments(Surface target, Color color, const Segment* segments, int count) override;
+    void draw_text_row(Surface target, Color color, int baseline,
+                       const TextItem* items, int count) override;
+    void copy_area(Surface from, Surface to, const Rect& area) override;
+
+private:
+    Drawable drawable(Surface surface) const;
+    // Offset subtracted from coordinates drawn to surface, non-zero in a slot.
+    int dx(Surface surface) const { return surface == SURFACE_WINDOW ? slot_x_ : 0; }
+    int dy(Surface surface) const { return surface == SURFACE_WINDOW ? slot_y_ : 0; }
+    void add_damage(Surface target, int x0, int y0, int x1, int y1);
+    void use_color(Color color);
+    void draw_glyph_row(Surface target, Color color, int baseline, const TextItem* items, int count);
+
+    Display* display_;
+    XFontStruct* font_;
+    unsigned long pixels_[COLOR_COUNT] = {};
+    Window window_ = 0;
+    Pixmap grid_ = 0;
+    Pixmap back_ = 0;
+    GC gc_ = 0;
+    Rect damage_ = {};   // bounds of what was drawn into back_ since present()
+    int gc_color_ = -1;  // color the GC foreground is set to, -1 if unknown
+
+    // XRender state, only with an Xft font. Labels are ASCII, so glyph
+    // indices and advances are looked up once per character code.
+    XftFont* xft_;
+    XRenderPictFormat* format_ = nullptr;
+    Picture fills_[COLOR_COUNT] = {};
+    Picture back_picture_ = 0;
+    Picture grid_picture_ = 0;
+    FT_UInt glyphs_[128] = {};
+    int advances_[128] = {};
+
+    std::vector<Pixmap> slots_;
+    std::vector<Picture> slot_pictures_;
+    int slot_ = -1;      // slot being drawn into, -1 for the back buffer
+    int slot_x_ = 0, slot_y_ = 0;
+
+    std::vector<XRectangle> rects_;
+    std::vector<XSegment> segments_;
+    std::vector<XTextItem> items_;
+    std::vector<XftGlyphSpec> glyph_specs_;
+};
+
+#endif
@@ -0,0 +1,206 @@
+// Microbenchmarks for layout, label encoding/decoding and drawing, run
+// against the in-memory backend so no X server is needed: make bench
+//
+// Usage: strix_bench [name-filter]
+
+#include "../grid.h"
+#include "../render.h"
+#include "../zoom.h"
+#include "../backend_memory.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+// Every heap allocation goes through here so steady-state paths can be
+// checked for allocations.
+static unsigned long allocation_count = 0;
+
+void* operator new(std::size_t size) {
+    allocation_count++;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+struct Resolution {
+    const char* name;
+    int width, height;
+};
+
+static const Resolution resolutions[] = {
+    {"1080p", 1920, 1080},
+    {"4k", 3840, 2160},
+    {"8k", 7680, 4320},
+};
+
+static const char* filter = nullptr;
+
+// Run body until at least min_time has passed and report the mean time and
+// allocations per call. extra, if set, is printed after the measurements.
+// reset, if set, runs after every call outside the timed part.
+static void run(const std::string& name, const std::function<void()>& body,
+                const std::function<std::string()>& extra = nullptr,
+                const std::function<void()>& reset = nullptr) {
+    if (filter && name.find(filter) == std::string::npos) return;
+
+    using clock = std::chrono::steady_clock;
+    const auto min_time = std::chrono::milliseconds(200);
+
+    body();  // warm up caches and scratch buffers
+    if (reset) reset();
+
+    long iterations = 0;
+    unsigned long allocs_before = allocation_count;
+    auto start = clock::now();
+    auto elapsed = clock::duration::zero();
+    long batch = 1;
+    if (reset) {
+        // Time each call on its own so the resets are left out.
+        elapsed = clock::duration::zero();
+        while (elapsed < min_time) {
+            auto call_start = clock::now();
+            body();
+            elapsed += clock::now() - call_start;
+            ++iterations;
+            reset();
+        }
+    }
+    while (elapsed < min_time) {
+        for (long i = 0; i < batch; ++i) body();
+        iterations += batch;
+        elapsed = clock::now() - start;
+        if (batch < (1L << 20)) batch *= 2;
+    }
+    unsigned long allocs = allocation_count - allocs_before;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    std::printf("%-32s %12.0f ns/op %10.2f allocs/op", name.c_str(), ns, (double)allocs / iterations);
+    if (extra) std::printf("  %s", extra().c_str());
+    std::printf("\n");
+}
+
+static GridLayout make_layout(const Resolution& res) {
+    GridLayout layout;
+    if (!build_grid_layout(layout, {{0, 0, res.width, res.height}}, default_label_alphabet)) {
+        std::fprintf(stderr, "Failed to build %s layout\n", res.name);
+        std::exit(1);
+    }
+    return layout;
+}
+
+// Type a cell's label one character at a time, dimming and highlighting as
+// the overlay does.
+static void type_label(MemoryBackend& backend, const GridLayout& layout, int cell_index,
+                       std::vector<int>& dimmed) {
+    const GridCell& cell = layout.cells[cell_index];
+    int node = 0;
+    for (int pos = 0; pos < cell.label_len; ++pos) {
+        int next = trie_step(layout, node, cell.label[pos]);
+        trimmed_candidates(layout, node, next, dimmed);
+        render_dimmed_cells(backend, layout, SURFACE_WINDOW, dimmed);
+        node = next;
+    }
+    int target = resolved_cell(layout, node);
+    ZoomView view = {cell_rect(layout.cells[target]), default_zoom_keys, 3, {}};
+    render_highlighted_cell(backend, layout, SURFACE_WINDOW, target, view);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) filter = argv[1];
+    const std::string alphabet = default_label_alphabet;
+
+    for (const Resolution& res : resolutions) {
+        std::string prefix = std::string(res.name) + "/";
+        std::vector<Monitor> heads = {{0, 0, res.width, res.height}};
+        GridLayout layout = make_layout(res);
+        std::string cells = std::to_string(layout.cells.size()) + " cells";
+
+        run(prefix + "layout_build", [&] {
+            GridLayout fresh;
+            build_grid_layout(fresh, heads, alphabet);
+        }, [&] { return cells; });
+
+        GridLayout relabel = layout;
+        run(prefix + "label_encode", [&] {
+            assign_labels(relabel, alphabet);
+        });
+
+        run(prefix + "label_trie", [&] {
+            build_label_trie(relabel);
+        });
+
+        // Decode every label through the trie; reported per label.
+        const size_t n = layout.cells.size();
+        volatile int sink = 0;
+        size_t next_cell = 0;
+        run(prefix + "label_decode", [&] {
+            const GridCell& cell = layout.cells[next_cell];
+            int node = 0;
+            for (int pos = 0; pos < cell.label_len; ++pos) {
+                node = trie_step(layout, node, cell.label[pos]);
+            }
+            sink = resolved_cell(layout, node);
+            next_cell = next_cell + 1 == n ? 0 : next_cell + 1;
+        });
+        (void)sink;
+
+        MemoryBackend recorder(layout.width, layout.height, false);
+        run(prefix + "full_redraw_record", [&] {
+            render_base_grid(recorder, layout, SURFACE_GRID);
+        }, [&] {
+            MemoryBackend once(layout.width, layout.height, false);
+            render_base_grid(once, layout, SURFACE_GRID);
+            return std::to_string(once.counters.requests) + " requests, " +
+                   std::to_string(once.counters.glyphs) + " glyphs";
+        });
+
+        MemoryBackend raster(layout.width, layout.height, true);
+        run(prefix + "full_redraw_raster", [&] {
+            render_base_grid(raster, layout, SURFACE_GRID);
+        });
+
+        // One selection: type a label. The record variant shows what is sent
+        // per selection; the raster variant restores the window between
+        // selections, outside the timing.
+        const size_t stride = 7919;  // spread targets over the grid
+        std::vector<int> dimmed;
+        size_t target = 0;
+        run(prefix + "incremental_record", [&] {
+            type_label(recorder, layout, (int)target, dimmed);
+            target = (target + stride) % n;
+        }, [&] {
+            MemoryBackend once(layout.width, layout.height, false);
+            std::vector<int> scratch;
+            type_label(once, layout, (int)(n / 2), scratch);
+            return std::to_string(once.counters.requests) + " requests, " +
+                   std::to_string(once.counters.rects) + " rects";
+        });
+
+        render_base_grid(raster, layout, SURFACE_GRID);
+        Rect all = {0, 0, layout.width, layout.height};
+        raster.copy_area(SURFACE_GRID, SURFACE_WINDOW, all);
+        run(prefix + "incremental_raster", [&] {
+            type_label(raster, layout, (int)target, dimmed);
+            target = (target + stride) % n;
+        }, nullptr, [&] {
+            raster.copy_area(SURFACE_GRID, SURFACE_WINDOW, all);
+        });
+
+        std::printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,331 @@
+// End-to-end latency benchmark. Starts a private Xvfb and strix on it, then
+// drives strix with XTest from a separate client and times what the user
+// would feel:
+//
+//   chord:  Ctrl+chord keys pressed -> overlay MapNotify
+//   warp:   last key of a cell ID   -> pointer MotionNotify
+//   click:  subcell key             -> ButtonPress
+//
+// Usage: strix_latency [--iterations N] [--strix PATH] [-- STRIX_ARGS...]
+//
+// Needs Xvfb on PATH and the XTest extension; runs headless.
+
+#include "../grid.h"
+#include "../zoom.h"
+
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static void fatal(const std::string& msg) {
+    std::cerr << "Fatal error: " << msg << std::endl;
+    std::exit(1);
+}
+
+static pid_t xvfb_pid = -1;
+static pid_t strix_pid = -1;
+
+static void stop_children() {
+    if (strix_pid > 0) {
+        kill(strix_pid, SIGINT);
+        waitpid(strix_pid, nullptr, 0);
+        strix_pid = -1;
+    }
+    if (xvfb_pid > 0) {
+        kill(xvfb_pid, SIGTERM);
+        waitpid(xvfb_pid, nullptr, 0);
+        xvfb_pid = -1;
+    }
+}
+
+// Start Xvfb on a free display; -displayfd reports the number once it
+// accepts connections.
+static std::string start_xvfb() {
+    int fds[2];
+    if (pipe(fds) != 0) fatal("pipe failed");
+
+    xvfb_pid = fork();
+    if (xvfb_pid == 0) {
+        close(fds[0]);
+        std::string fd = std::to_string(fds[1]);
+        execlp("Xvfb", "Xvfb", "-displayfd", fd.c_str(), "-screen", "0", "1920x1080x24",
+               "-nolisten", "tcp", (char*)nullptr);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    char buf[16] = {};
+    ssize_t n = 0, got;
+    while (n < (ssize_t)sizeof(buf) - 1 && (got = read(fds[0], buf + n, sizeof(buf) - 1 - n)) > 0) {
+        n += got;
+        if (buf[n - 1] == '\n') break;
+    }
+    close(fds[0]);
+    if (n <= 0) fatal("Xvfb did not start (is it installed?)");
+    return ":" + std::string(buf, std::strcspn(buf, "\n"));
+}
+
+static void start_strix(const std::string& path, const std::string& display_name,
+                        const std::vector<std::string>& args) {
+    strix_pid = fork();
+    if (strix_pid == 0) {
+        setenv("DISPLAY", display_name.c_str(), 1);
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(path.c_str()));
+        for (const std::string& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+        argv.push_back(nullptr);
+        execv(path.c_str(), argv.data());
+        _exit(127);
+    }
+}
+
+Display* display;
+Window root;
+
+// Wait up to timeout_ms for an event accepted by match; returns the time it
+// was read, or fails the run.
+template <typename Match>
+static Clock::time_point wait_for(const char* what, int timeout_ms, Match match, XEvent* out = nullptr) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    for (;;) {
+        while (XPending(display)) {
+            XEvent ev;
+            XNextEvent(display, &ev);
+            if (match(ev)) {
+                if (out) *out = ev;
+                return Clock::now();
+            }
+        }
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        if (left <= 0) {
+            stop_children();
+            fatal(std::string("Timed out waiting for ") + what);
+        }
+        pollfd pfd = {ConnectionNumber(display), POLLIN, 0};
+        poll(&pfd, 1, (int)left);
+    }
+}
+
+// Wait up to timeout_ms for window to get the input focus, or fail the run.
+static void wait_for_focus(Window window, int timeout_ms) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    for (;;) {
+        Window focus;
+        int revert;
+        XGetInputFocus(display, &focus, &revert);
+        if (focus == window) return;
+        if (Clock::now() >= deadline) {
+            stop_children();
+            fatal("Timed out waiting for overlay focus");
+        }
+        usleep(100);
+    }
+}
+
+static KeyCode keycode_for(const char* name) {
+    KeySym sym = XStringToKeysym(name);
+    KeyCode code = sym == NoSymbol ? 0 : XKeysymToKeycode(display, sym);
+    if (!code) fatal(std::string("No keycode for ") + name);
+    return code;
+}
+
+static void fake_key(KeyCode code, bool press) {
+    XTestFakeKeyEvent(display, code, press, CurrentTime);
+}
+
+// Press and release a key; returns the time the press was sent.
+static Clock::time_point tap(KeyCode code) {
+    fake_key(code, true);
+    fake_key(code, false);
+    auto sent = Clock::now();
+    XFlush(display);
+    return sent;
+}
+
+struct Series {
+    const char* name;
+    std::vector<double> us;
+};
+
+static void report(Series& s) {
+    std::sort(s.us.begin(), s.us.end());
+    auto pct = [&](double p) { return s.us[std::min(s.us.size() - 1, (size_t)(p * s.us.size()))]; };
+    std::printf("%-8s n=%-6zu p50 %8.1f us   p99 %8.1f us   max %8.1f us\n",
+                s.name, s.us.size(), pct(0.50), pct(0.99), s.us.back());
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = 2000;
+    std::string strix_path = "./strix";
+    std::vector<std::string> strix_args;
+    std::string alphabet = default_label_alphabet;
+    std::vector<std::string> chord_names = {"h", "t"};
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::stoi(argv[++i]);
+        } else if (arg == "--strix" && i + 1 < argc) {
+            strix_path = argv[++i];
+        } else if (arg == "--") {
+            for (++i; i < argc; ++i) strix_args.push_back(argv[i]);
+        } else {
+            fatal("Unknown argument: " + arg);
+        }
+    }
+    // The driver has to type the IDs and chord strix expects, so mirror them.
+    for (size_t i = 0; i + 1 < strix_args.size(); ++i) {
+        if (strix_args[i] == "--alphabet") alphabet = strix_args[i + 1];
+        if (strix_args[i] == "--chord") {
+            const std::string& spec = strix_args[i + 1];
+            chord_names.clear();
+            size_t start = 0;
+            while (start <= spec.size()) {
+                size_t plus = spec.find('+', start);
+                if (plus == std::string::npos) plus = spec.size();
+                if (plus > start) chord_names.push_back(spec.substr(start, plus - start));
+                start = plus + 1;
+            }
+            if (chord_names.empty()) fatal("--chord needs at least one key");
+        }
+        if (strix_args[i] == "--monitors" && strix_args[i + 1] != "all") {
+            fatal("Only --monitors all is supported; Xvfb has a single monitor anyway");
+        }
+    }
+    // Long enough that the overlay never times out during a run.
+    strix_args.insert(strix_args.begin(), {"--timeout", "3600"});
+
+    std::string display_name = start_xvfb();
+    display = XOpenDisplay(display_name.c_str());
+    if (!display) {
+        stop_children();
+        fatal("Unable to open " + display_name);
+    }
+    int event_base, error_base, major, minor;
+    if (!XTestQueryExtension(display, &event_base, &error_base, &major, &minor)) {
+        stop_children();
+        fatal("XTest not available on " + display_name);
+    }
+
+    int screen = DefaultScreen(display);
+    root = RootWindow(display, screen);
+    // Overlay maps, warps and the click on the root (strix hides the overlay
+    // before clicking) all reach this client through the root window.
+    XSelectInput(display, root, SubstructureNotifyMask | PointerMotionMask |
+                                ButtonPressMask | ButtonReleaseMask);
+    XSync(display, False);
+
+    GridLayout layout;
+    if (!build_grid_layout(layout, {{0, 0, DisplayWidth(display, screen), DisplayHeight(display, screen)}},
+                           alphabet)) {
+        stop_children();
+        fatal("Alphabet too small for the Xvfb screen");
+    }
+
+    start_strix(strix_path, display_name, strix_args);
+
+    KeyCode ctrl = keycode_for("Control_L");
+    std::vector<KeyCode> chord_keys;
+    for (const std::string& name : chord_names) chord_keys.push_back(keycode_for(name.c_str()));
+    KeyCode label_keys[256] = {};
+    for (char c : alphabet) {
+        label_keys[(unsigned char)c] = keycode_for(std::string(1, c).c_str());
+    }
+    const int center_subcell = (sizeof(default_zoom_keys) - 1) / 2;
+    KeyCode subcell_key = keycode_for(std::string(1, default_zoom_keys[center_subcell]).c_str());
+
+    // strix needs a moment to grab the chord; retry the first toggle until it maps.
+    Series chord = {"chord", {}}, warp = {"warp", {}}, click = {"click", {}};
+    bool ready = false;
+    for (int attempt = 0; attempt < 50 && !ready; ++attempt) {
+        usleep(100000);
+        fake_key(ctrl, true);
+        for (KeyCode k : chord_keys) fake_key(k, true);
+        for (size_t k = chord_keys.size(); k-- > 0;) fake_key(chord_keys[k], false);
+        fake_key(ctrl, false);
+        XFlush(display);
+        auto deadline = Clock::now() + std::chrono::milliseconds(200);
+        while (!ready && Clock::now() < deadline) {
+            while (XPending(display)) {
+                XEvent ev;
+                XNextEvent(display, &ev);
+                if (ev.type == MapNotify && ev.xmap.override_redirect) ready = true;
+            }
+            usleep(1000);
+        }
+    }
+    if (!ready) {
+        stop_children();
+        fatal("strix did not show its overlay; is " + strix_path + " built?");
+    }
+    tap(keycode_for("Escape"));
+    usleep(100000);
+    while (XPending(display)) {
+        XEvent ev;
+        XNextEvent(display, &ev);
+    }
+
+    const int n = (int)layout.cells.size();
+    for (int it = 0; it < iterations; ++it) {
+        const GridCell& cell = layout.cells[(size_t)it * 7919 % n];
+
+        // Chord: time from the last chord key press to the overlay being mapped.
+        fake_key(ctrl, true);
+        for (KeyCode k : chord_keys) fake_key(k, true);
+        auto sent = Clock::now();
+        XFlush(display);
+        XEvent mapped;
+        auto seen = wait_for("overlay map", 2000, [](XEvent& ev) {
+            return ev.type == MapNotify && ev.xmap.override_redirect;
+        }, &mapped);
+        chord.us.push_back(std::chrono::duration<double, std::micro>(seen - sent).count());
+        for (size_t k = chord_keys.size(); k-- > 0;) fake_key(chord_keys[k], false);
+        fake_key(ctrl, false);
+        XFlush(display);
+
+        // Typed keys only reach strix once it has focused the overlay.
+        wait_for_focus(mapped.xmap.window, 2000);
+
+        // Warp: time from the last key of the cell ID to the pointer moving there.
+        for (int pos = 0; pos + 1 < cell.label_len; ++pos) {
+            tap(label_keys[(unsigned char)cell.label[pos]]);
+        }
+        sent = tap(label_keys[(unsigned char)cell.label[cell.label_len - 1]]);
+        int cx = cell.x + grid_size / 2, cy = cell.y + grid_size / 2;
+        seen = wait_for("pointer warp", 2000, [&](XEvent& ev) {
+            return ev.type == MotionNotify && ev.xmotion.x_root == cx && ev.xmotion.y_root == cy;
+        });
+        warp.us.push_back(std::chrono::duration<double, std::micro>(seen - sent).count());
+
+        // Click: time from the subcell key to the button press being delivered.
+        sent = tap(subcell_key);
+        seen = wait_for("button press", 2000, [](XEvent& ev) { return ev.type == ButtonPress; });
+        click.us.push_back(std::chrono::duration<double, std::micro>(seen - sent).count());
+        wait_for("button release", 2000, [](XEvent& ev) { return ev.type == ButtonRelease; });
+    }
+
+    XCloseDisplay(display);
+    stop_children();
+
+    std::printf("%d iterations on a %dx%d Xvfb, %d cells\n", iterations,
+                layout.width, layout.height, n);
+    report(chord);
+    report(warp);
+    report(click);
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include "control.h"
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/extensions/XTest.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <sstream>
+
+static std::string parse_target(const std::string& target, const GridLayout& layout,
+                                const ZoomConfig& zoom, int& x, int& y) {
+    size_t comma = target.find(',');
+    if (comma != std::string::npos) {
+        char* end;
+        long px = std::strtol(target.c_str(), &end, 10);
+        if (end != target.c_str() + comma) return "bad coordinates: " + target;
+        long py = std::strtol(target.c_str() + comma + 1, &end, 10);
+        if (*end != '\0' || end == target.c_str() + comma + 1) return "bad coordinates: " + target;
+        x = (int)px;
+        y = (int)py;
+        return "";
+    }
+
+    size_t dot = target.find('.');
+    std::string id = target.substr(0, dot);
+    int node = 0;
+    for (char c : id) {
+        node = trie_step(layout, node, c);
+        if (node == -1) break;
+    }
+    int cell_index = node == -1 || id.empty() ? -1 : resolved_cell(layout, node);
+    if (cell_index == -1) return "unknown cell ID: " + id;
+
+    Rect region = cell_rect(layout.cells[cell_index]);
+    if (dot != std::string::npos &&
+        !zoom_path_region(zoom, region, target.substr(dot + 1), region)) {
+        return "unknown subcell: " + target;
+    }
+    x = layout.origin_x + region.x + region.width / 2;
+    y = layout.origin_y + region.y + region.height / 2;
+    return "";
+}
+
+std::string parse_control_batch(const std::string& line, const GridLayout& layout,
+                                const ZoomConfig& zoom, std::vector<ControlAction>& out) {
+    out.clear();
+    std::stringstream actions(line);
+    std::string text;
+    while (std::getline(actions, text, ';')) {
+        std::stringstream words(text);
+        std::string verb, target, mode, extra;
+        if (!(words >> verb)) continue;  // empty action, e.g. a trailing ';'
+
+        ControlAction action = {};
+        if (verb == "wait") {
+            char* end;
+            if (!(words >> target)) return "wait needs milliseconds";
+            long ms = std::strtol(target.c_str(), &end, 10);
+            if (*end != '\0' || ms < 0) return "bad wait: " + target;
+            action.kind = ControlAction::WAIT;
+            action.delay_ms = (int)ms;
+        } else if (verb == "move" || verb == "click") {
+            if (!(words >> target)) return verb + " needs a target";
+            std::string error = parse_target(target, layout, zoom, action.x, action.y);
+            if (!error.empty()) return error;
+            action.kind = verb == "move" ? ControlAction::MOVE : ControlAction::CLICK;
+            action.button = 1;
+            action.clicks = 1;
+            if (verb == "click" && words >> mode) {
+                if (mode == "left") {
+                    action.button = 1;
+                } else if (mode == "right") {
+                    action.button = 3;
+                } else if (mode == "middle") {
+                    action.button = 2;
+                } else if (mode == "double") {
+                    action.clicks = 2;
+                } else {
+                    return "unknown click mode: " + mode;
+                }
+            }
+        } else {
+            return "unknown action: " + verb;
+        }
+        if (words >> extra) return "unexpected '" + extra + "' after " + verb;
+        out.push_back(action);
+    }
+    if (out.empty()) return "empty batch";
+    return "";
+}
+
+// Batches run on their own X connection: XTest delays put the requesting
+// client to sleep in the server, which must not stall the overlay.
+static Display* control_display = nullptr;
+static Window marker_window = 0;
+static Atom marker_atom = None;
+
+static int listen_fd = -1;
+static std::string socket_path;
+
+struct ControlClient {
+    int fd;
+    std::string input;
+};
+static std::vector<ControlClient> clients;
+
+// Batches sent to the server, oldest first. Each action is followed by a
+// property change on marker_window; the server handles a connection's
+// requests in order, so each PropertyNotify completes the oldest open action.
+struct ControlBatch {
+    int client_fd;  // -1 once the client has gone away
+    std::chrono::steady_clock::time_point start;
+    std::vector<long> done_us;
+    size_t completed;
+};
+static std::deque<ControlBatch> in_flight;
+
+static const size_t max_line_length = 65536;
+
+std::string control_open(const std::string& path) {
+    control_display = XOpenDisplay(nullptr);
+    if (!control_display) return "unable to open a second X connection";
+    int event_base, error_base, major, minor;
+    if (!XTestQueryExtension(control_display, &event_base, &error_base, &major, &minor)) {
+        return "XTest extension not available";
+    }
+    marker_window = XCreateSimpleWindow(control_display, DefaultRootWindow(control_display),
+                                        0, 0, 1, 1, 0, 0, 0);
+    XSelectInput(control_display, marker_window, PropertyChangeMask);
+    marker_atom = XInternAtom(control_display, "_STRIX_CONTROL_MARK", False);
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return "socket path too long";
+    std::strcpy(addr.sun_path, path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) return std::string("socket: ") + std::strerror(errno);
+    // Remove a socket left over from a previous run, but nothing else.
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) return path + " exists and is not a socket";
+        unlink(path.c_str());
+    }
+    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0) {
+        return path + ": " + std::strerror(errno);
+    }
+    socket_path = path;
+    return "";
+}
+
+void control_close() {
+    for (const ControlClient& client : clients) close(client.fd);
+    clients.clear();
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path.c_str());
+        listen_fd = -1;
+    }
+    if (control_display) {
+        XCloseDisplay(control_display);
+        control_display = nullptr;
+    }
+}
+
+int control_poll_fds(pollfd* fds, int max) {
+    int n = 0;
+    if (listen_fd < 0) return 0;
+    if (n < max) fds[n++] = {listen_fd, POLLIN, 0};
+    if (n < max) fds[n++] = {ConnectionNumber(control_display), POLLIN, 0};
+    for (const ControlClient& client : clients) {
+        if (n < max) fds[n++] = {client.fd, POLLIN, 0};
+    }
+    return n;
+}
+
+bool control_has_queued_events() {
+    return control_display && XQLength(control_display) > 0;
+}
+
+static void reply(int fd, const std::string& text) {
+    if (fd < 0) return;
+    // Replies are short; a client that cannot take one is not reading anyway.
+    (void)send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+}
+
+static void drop_client(int fd) {
+    for (size_t i = 0; i < clients.size(); ++i) {
+        if (clients[i].fd == fd) {
+            close(fd);
+            clients.erase(clients.begin() + i);
+            break;
+        }
+    }
+    for (ControlBatch& batch : in_flight) {
+        if (batch.client_fd == fd) batch.client_fd = -1;
+    }
+}
+
+// Queue a whole batch with one flush. Press lengths, double click gaps and
+// waits are XTest delays, so the server paces the stream itself.
+static void run_batch(int fd, const std::vector<ControlAction>& actions, const ControlTiming& timing) {
+    Window root = DefaultRootWindow(control_display);
+    for (const ControlAction& action : actions) {
+        switch (action.kind) {
+            case ControlAction::MOVE:
+                XWarpPointer(control_display, None, root, 0, 0, 0, 0, action.x, action.y);
+                break;
+            case ControlAction::CLICK:
+                XWarpPointer(control_display, None, root, 0, 0, 0, 0, action.x, action.y);
+                for (int i = 0; i < action.clicks; ++i) {
+                    XTestFakeButtonEvent(control_display, action.button, True,
+                                         i > 0 ? timing.double_click_interval_ms : CurrentTime);
+                    XTestFakeButtonEvent(control_display, action.button, False,
+                                         timing.press_duration_ms);
+                }
+                break;
+            case ControlAction::WAIT:
+                XTestFakeRelativeMotionEvent(control_display, 0, 0, action.delay_ms);
+                break;
+        }
+        XChangeProperty(control_display, marker_window, marker_atom, XA_INTEGER, 32,
+                        PropModeReplace, nullptr, 0);
+    }
+    in_flight.push_back({fd, std::chrono::steady_clock::now(),
+                         std::vector<long>(actions.size()), 0});
+    XFlush(control_display);
+}
+
+static void process_markers() {
+    while (XPending(control_display)) {
+        XEvent ev;
+        XNextEvent(control_display, &ev);
+        if (ev.type != PropertyNotify || ev.xproperty.atom != marker_atom || in_flight.empty()) {
+            continue;
+        }
+        ControlBatch& batch = in_flight.front();
+        batch.done_us[batch.completed++] = (long)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - batch.start).count();
+        if (batch.completed == batch.done_us.size()) {
+            std::string line = "ok";
+            for (long us : batch.done_us) line += " " + std::to_string(us);
+            reply(batch.client_fd, line + "\n");
+            in_flight.pop_front();
+        }
+    }
+}
+
+static void read_client(int fd, const GridLayout& layout, const ZoomConfig& zoom,
+                        const ControlTiming& timing) {
+    ControlClient* client = nullptr;
+    for (ControlClient& c : clients) {
+        if (c.fd == fd) client = &c;
+    }
+    if (!client) return;
+
+    char buf[4096];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        drop_client(fd);
+        return;
+    }
+    if (n < 0) return;
+    client->input.append(buf, n);
+
+    std::vector<ControlAction> actions;
+    size_t newline;
+    while ((newline = client->input.find('\n')) != std::string::npos) {
+        std::string line = client->input.substr(0, newline);
+        client->input.erase(0, newline + 1);
+        std::string error = parse_control_batch(line, layout, zoom, actions);
+        if (error.empty()) {
+            run_batch(fd, actions, timing);
+        } else {
+            reply(fd, "error " + error + "\n");
+        }
+    }
+    if (client->input.size() > max_line_length) {
+        reply(fd, "error batch too long\n");
+        drop_client(fd);
+    }
+}
+
+void control_handle(const pollfd* fds, int count, const GridLayout& layout, const ZoomConfig& zoom,
+                    const ControlTiming& timing) {
+    if (listen_fd < 0) return;
+
+    for (int i = 0; i < count; ++i) {
+        if (!fds[i].revents) continue;
+        if (fds[i].fd == listen_fd) {
+            int fd;
+            while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                clients.push_back({fd, ""});
+            }
+        } else if (fds[i].fd != ConnectionNumber(control_display)) {
+            read_client(fds[i].fd, layout, zoom, timing);
+        }
+    }
+    // Markers may already sit in Xlib's queue, so check even without POLLIN.
+    process_markers();
+}
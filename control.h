@@ -0,0 +1,48 @@
+#ifndef STRIX_CONTROL_H
+#define STRIX_CONTROL_H
+
+#include "grid.h"
+#include "zoom.h"
+
+#include <poll.h>
+#include <string>
+#include <vector>
+
+// A scripted pointer action, resolved to root coordinates.
+struct ControlAction {
+    enum Kind { MOVE, CLICK, WAIT };
+    Kind kind;
+    int x, y;        // MOVE and CLICK
+    int button;      // CLICK: 1 left, 2 middle, 3 right
+    int clicks;      // CLICK: 2 for a double click
+    int delay_ms;    // WAIT
+};
+
+// Parse one batch: actions separated by ';'. Targets are cell IDs ("ab"),
+// zoom paths within a cell of layout ("ab.t", "ab.tc" with --zoom-depth 2),
+// or root coordinates ("640,480"). Returns an error message, or an empty
+// string on success.
+std::string parse_control_batch(const std::string& line, const GridLayout& layout,
+                                const ZoomConfig& zoom, std::vector<ControlAction>& out);
+
+struct ControlTiming {
+    int press_duration_ms;
+    int double_click_interval_ms;
+};
+
+// Listen on a Unix socket at path and open the X connection batches run on.
+// Returns an error message, or an empty string on success.
+std::string control_open(const std::string& path);
+void control_close();
+
+// Descriptors the main loop should poll for the control socket; returns how
+// many were written to fds (at most max).
+int control_poll_fds(pollfd* fds, int max);
+// Whether events are already queued locally, so polling must not block.
+bool control_has_queued_events();
+// Accept clients, run complete batches and answer finished ones. fds are the
+// entries filled by control_poll_fds, after poll. IDs resolve against layout.
+void control_handle(const pollfd* fds, int count, const GridLayout& layout, const ZoomConfig& zoom,
+                    const ControlTiming& timing);
+
+#endif
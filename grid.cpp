@@ -0,0 +1,146 @@
+#include "grid.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+
+// Labels are typed, lowercased, alphanumeric characters; each may appear once.
+std::string check_label_alphabet(const std::string& alphabet) {
+    std::bitset<256> seen;
+    for (char c : alphabet) {
+        unsigned char uc = (unsigned char)c;
+        if (!std::isalnum(uc) || std::isupper(uc) || seen.test(uc)) {
+            return "use distinct lowercase letters and digits";
+        }
+        seen.set(uc);
+    }
+    if (alphabet.size() < 2) {
+        return "at least two characters are needed";
+    }
+    return "";
+}
+
+// Pick the shortest label length that fits all cells, then give as many cells
+// as possible a label one character shorter: prefixes that are not expanded
+// stay leaves of the trie, so the label set remains prefix-free.
+bool assign_labels(GridLayout& layout, const std::string& alphabet) {
+    const long long k = (long long)alphabet.size();
+    const long long n = (long long)layout.cells.size();
+
+    int len = 1;
+    long long capacity = k;
+    while (capacity < n) {
+        capacity *= k;
+        ++len;
+    }
+    if (len > max_label_len) {
+        return false;
+    }
+
+    long long short_count = 0;
+    if (len > 1) {
+        long long prefixes = capacity / k;
+        short_count = std::min(prefixes, (capacity - n) / (k - 1));
+    }
+
+    for (long long i = 0; i < n; ++i) {
+        GridCell& cell = layout.cells[i];
+        int cell_len;
+        long long value;
+        if (i < short_count) {
+            cell_len = len - 1;
+            value = i;
+        } else {
+            cell_len = len;
+            value = short_count * k + (i - short_count);
+        }
+        for (int pos = cell_len - 1; pos >= 0; --pos) {
+            cell.label[pos] = alphabet[value % k];
+            value /= k;
+        }
+        cell.label_len = (uint8_t)cell_len;
+    }
+    return true;
+}
+
+void build_label_trie(GridLayout& layout) {
+    const int k = layout.alphabet_size;
+    layout.trie_children.assign(k, -1);
+    layout.node_first.assign(1, 0);
+    layout.node_count.assign(1, (int32_t)layout.cells.size());
+
+    for (size_t i = 0; i < layout.cells.size(); ++i) {
+        const GridCell& cell = layout.cells[i];
+        int node = 0;
+        for (int pos = 0; pos < cell.label_len; ++pos) {
+            int slot = node * k + layout.symbol_of[(unsigned char)cell.label[pos]];
+            int child = layout.trie_children[slot];
+            if (child == -1) {
+                child = (int)layout.node_first.size();
+                layout.trie_children[slot] = child;
+                layout.trie_children.resize(layout.trie_children.size() + k, -1);
+                layout.node_first.push_back((int32_t)i);
+                layout.node_count.push_back(0);
+            }
+            layout.node_count[child]++;
+            node = child;
+        }
+    }
+}
+
+bool build_grid_layout(GridLayout& layout, const std::vector<Monitor>& heads,
+                       const std::string& alphabet) {
+    int min_x = heads[0].x, min_y = heads[0].y;
+    int max_x = heads[0].x + heads[0].width, max_y = heads[0].y + heads[0].height;
+    for (const Monitor& m : heads) {
+        min_x = std::min(min_x, m.x);
+        min_y = std::min(min_y, m.y);
+        max_x = std::max(max_x, m.x + m.width);
+        max_y = std::max(max_y, m.y + m.height);
+    }
+    layout.origin_x = min_x;
+    layout.origin_y = min_y;
+    layout.width = max_x - min_x;
+    layout.height = max_y - min_y;
+
+    layout.blocks.clear();
+    layout.cells.clear();
+    for (const Monitor& m : heads) {
+        GridBlock block;
+        block.x = m.x - min_x;
+        block.y = m.y - min_y;
+        block.width = m.width;
+        block.height = m.height;
+        block.cols = (m.width + grid_size - 1) / grid_size;
+        block.rows = (m.height + grid_size - 1) / grid_size;
+        block.first_cell = (int)layout.cells.size();
+        for (int r = 0; r < block.rows; ++r) {
+            for (int c = 0; c < block.cols; ++c) {
+                layout.cells.push_back({block.x + c * grid_size, block.y + r * grid_size, {}, 0});
+            }
+        }
+        layout.blocks.push_back(block);
+    }
+
+    layout.alphabet_size = (int)alphabet.size();
+    layout.symbol_of.fill(-1);
+    for (size_t i = 0; i < alphabet.size(); ++i) {
+        layout.symbol_of[(unsigned char)alphabet[i]] = (int8_t)i;
+    }
+
+    if (!assign_labels(layout, alphabet)) {
+        return false;
+    }
+    build_label_trie(layout);
+    return true;
+}
+
+int trie_step(const GridLayout& layout, int node, char c) {
+    int symbol = layout.symbol_of[(unsigned char)c];
+    if (symbol < 0) return -1;
+    return layout.trie_children[node * layout.alphabet_size + symbol];
+}
+
+int resolved_cell(const GridLayout& layout, int node) {
+    return layout.node_count[node] == 1 ? layout.node_first[node] : -1;
+}
@@ -0,0 +1,74 @@
+#ifndef STRIX_GRID_H
+#define STRIX_GRID_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+const int grid_size = 50;
+
+// Characters cell labels are built from by default. Labels are generated
+// prefix-free, so a label is selected as soon as its typed prefix is unique.
+const char default_label_alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+const int max_label_len = 8;
+
+// A monitor (XRandR CRTC) in root coordinates.
+struct Monitor {
+    int x, y;
+    int width, height;
+};
+
+struct GridCell {
+    int x, y;        // top-left corner in overlay window coordinates
+    char label[max_label_len];
+    uint8_t label_len;
+};
+
+// The regular grid covering one monitor, in overlay window coordinates. Its
+// cells are cols * rows consecutive entries of GridLayout::cells, row by row.
+struct GridBlock {
+    int x, y;
+    int width, height;
+    int cols, rows;
+    int first_cell;
+};
+
+// Precomputed grid for a set of monitors, one block per monitor so no cell
+// spans two of them. Cells are stored in reading order within each block and
+// labels are assigned in lexicographic order, so the cells below any trie
+// node form the contiguous range [node_first[n], node_first[n] + node_count[n]).
+struct GridLayout {
+    int origin_x = 0;  // overlay window position and size on the root
+    int origin_y = 0;
+    int width = 0;
+    int height = 0;
+    std::vector<GridBlock> blocks;
+    std::vector<GridCell> cells;
+
+    int alphabet_size = 0;
+    std::array<int8_t, 256> symbol_of;   // character -> alphabet index, -1 if unused
+    std::vector<int32_t> trie_children;  // node * alphabet_size + symbol -> node, -1 if none
+    std::vector<int32_t> node_first;
+    std::vector<int32_t> node_count;
+};
+
+// Why alphabet cannot be used for labels, or an empty string if it can.
+std::string check_label_alphabet(const std::string& alphabet);
+
+// Lay out cells for heads and label them from alphabet. Returns false if the
+// alphabet is too small to label every cell within max_label_len characters.
+bool build_grid_layout(GridLayout& layout, const std::vector<Monitor>& heads,
+                       const std::string& alphabet);
+
+// The two halves of labelling, exposed for benchmarking.
+bool assign_labels(GridLayout& layout, const std::string& alphabet);
+void build_label_trie(GridLayout& layout);
+
+// Trie node reached from node by typing c, or -1 if no label continues that way.
+int trie_step(const GridLayout& layout, int node, char c);
+
+// The cell a trie node identifies once only one candidate is left, else -1.
+int resolved_cell(const GridLayout& layout, int node);
+
+#endif
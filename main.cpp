@@ -1,18 +1,41 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/keysym.h>
+#include <X11/XKBlib.h>
+#include <X11/Xproto.h>
 #include <X11/extensions/shape.h>
 #include <X11/extensions/XTest.h>
+#include <X11/extensions/Xrandr.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <cerrno>
 #include <iostream>
 #include <string>
 #include <cctype>
+#include <cstdio>
 #include <cstring>
 #include <cassert>
+#include <algorithm>
 #include <array>
+#include <deque>
+#include <bitset>
+#include <vector>
+#include <cstdint>
 #include <cstdlib>
 #include <chrono>
 #include <csignal>
+#include <fstream>
+#include <sstream>
+
+#include "grid.h"
+#include "render.h"
+#include "backend_x11.h"
+#include "trace.h"
+#include "control.h"
+#include "session.h"
+#include "snap.h"
+#include "zoom.h"
 
 static void fatal(const std::string& msg) {
     std::cerr << "Fatal error: " << msg << std::endl;
@@ -22,263 +45,769 @@ static void fatal(const std::string& msg) {
 Display *display;
 Window root;
 Window overlay = 0;
+Pixmap grid_pixmap = 0;   // base grid rendered once per overlay, source for repaints
+Pixmap back_pixmap = 0;   // frame being drawn; the window background, copied in by present_frame
+GC overlay_gc = 0;
 bool overlayVisible = false;
-std::chrono::steady_clock::time_point overlay_start_time;
+int overlay_timer_fd = -1;  // timerfd that fires when the overlay times out
+bool persistent_overlay = false;  // keep the overlay window around between toggles
+bool shaped_overlay = false;      // clip the overlay to its lines, labels and highlight
+bool snap_to_windows = false;     // warp to window centres inside the selected region
+
+Atom opacity_atom;
+Atom cardinal_atom;
 
 std::string typed_chars = "";
-std::string highlighted_cell = "";
-std::string highlighted_subcell = "";
+int highlighted_cell = -1;     // index into active_layout->cells, -1 if none
+int highlighted_subcell = -1;  // part last picked within the zoom region, -1 if none
+
+// Refinement of the highlighted cell (--zoom-keys, --zoom-depth): each zoom
+// key picks a part of zoom_region, which then becomes the next region.
+ZoomConfig zoom_config;
+bool zoom_depth_auto = false;
+int zoom_level = 0;   // level the next zoom key selects in
+Rect zoom_region;     // part of the highlighted cell being refined
+Rect zoom_legend;     // key map beside the cell once labels no longer fit, else empty
+int zoom_max_dim = 0; // largest grid of any level, sizes the key map
 
 bool toggle_in_progress = false;  // prevent repeated toggling while keys held
 int overlay_timeout_seconds = 30; // timeout in seconds
 int overlay_timeout_ms = overlay_timeout_seconds * 1000; // derived milliseconds
 
-KeyCode keycode_h;
-KeyCode keycode_t;
+// Keys that, held together with Ctrl, toggle the overlay (--chord, default h+t).
+std::vector<std::string> chord_key_names = {"h", "t"};
+std::vector<KeyCode> chord_keycodes;
+
+// Keys currently held, tracked from KeyPress/KeyRelease so chord detection
+// needs no XQueryKeymap round trip. Outside the overlay only the grabs bring
+// key events here, so presses and releases made elsewhere are missed; the
+// set is resynced from the server once each time a grab activates.
+std::bitset<256> keys_down;
+
+const uint32_t bright_rgb = 0xFFFF00;  // main cell labels
+const uint32_t dark_rgb = 0x333333;    // subcell labels
 
-unsigned long orange_pixel;       // pixel value for orange text (subcells)
-unsigned long bright_pixel;       // pixel value for bright main cell text
-unsigned long dark_pixel;         // pixel value for dark text
+XFontStruct *label_font = nullptr; // metrics of the default GC font, queried once
+XftFont *label_xft_font = nullptr;  // --font, drawn through XRender; null falls back to label_font
+std::string label_font_name = "monospace:bold:size=9";
+X11Backend *backend = nullptr;     // draws the grid into the overlay and its pixmap
 
 enum ClickMode { LEFT_CLICK, RIGHT_CLICK, MIDDLE_CLICK, DOUBLE_CLICK };
 ClickMode current_click_mode = LEFT_CLICK;
 
 volatile std::sig_atomic_t keepRunning = 1;
 
+// Main loop wakeup counters, printed on exit with --wakeup-stats.
+struct LoopStats {
+    unsigned long wakeups = 0;        // returns from poll
+    unsigned long x_wakeups = 0;      // X connection readable
+    unsigned long timer_wakeups = 0;  // overlay timeout fired
+    unsigned long action_wakeups = 0; // queued pointer action came due
+    unsigned long idle_wakeups = 0;   // nothing to do (signals, spurious)
+};
+LoopStats loop_stats;
+bool report_wakeups = false;
+
+// --startup-profile: wall time of each startup phase, printed once ready.
+bool startup_profile = false;
+std::vector<std::pair<const char*, uint64_t>> startup_phases;
+uint64_t startup_phase_start = 0;
+
+void startup_phase_done(const char* name) {
+    uint64_t now = trace_now();
+    startup_phases.push_back({name, now - startup_phase_start});
+    startup_phase_start = now;
+}
+
+void print_startup_profile() {
+    uint64_t total = 0;
+    std::fprintf(stderr, "Startup:\n");
+    for (const auto& phase : startup_phases) {
+        std::fprintf(stderr, "  %-12s %9.3f ms\n", phase.first, phase.second / 1e6);
+        total += phase.second;
+    }
+    std::fprintf(stderr, "  %-12s %9.3f ms\n", "total", total / 1e6);
+}
+
+// Unix socket accepting batches of scripted clicks (--control-socket).
+std::string control_socket_path;
+
+// Session logging for --record and --replay; see session.h for the format.
+FILE* record_file = nullptr;
+bool replaying = false;
+std::vector<SessionEntry> replay_capture;  // what the replay did, for comparison
+std::string last_logged_state;
+
+bool logging_session() {
+    return record_file || replaying;
+}
+
+void log_session(char kind, const std::string& body) {
+    if (!logging_session()) return;
+    SessionEntry entry = {kind, trace_now(), body};
+    if (record_file) write_session_entry(record_file, entry);
+    if (replaying) replay_capture.push_back(entry);
+}
+
 void signal_handler(int signum) {
     (void)signum; // unused
     keepRunning = 0;
 }
 
-void click_pointer(ClickMode mode);
-
-void destroy_overlay(bool should_click = false);
+// SIGUSR1 asks for a dump of the stage histograms (and --stats-file/--trace-json).
+volatile std::sig_atomic_t dump_requested = 0;
+std::string stats_file_path;
+std::string trace_json_path;
 
-void hide_overlay_without_click() {
-    if (overlay) {
-        (void)XSetInputFocus(display, root, RevertToParent, CurrentTime);
-
-        (void)XDestroyWindow(display, overlay);
-        overlay = 0;
-        highlighted_cell = "";
-        highlighted_subcell = "";
-        typed_chars = "";
+void dump_signal_handler(int signum) {
+    (void)signum;
+    dump_requested = 1;
+}
 
-        overlayVisible = false;
+void dump_stats(bool to_stderr) {
+    if (to_stderr) {
+        trace_dump(std::cerr);
+    }
+    if (!stats_file_path.empty()) {
+        std::ofstream out(stats_file_path, std::ios::trunc);
+        trace_dump(out);
+        if (!out) {
+            std::cerr << "Failed to write stats to " << stats_file_path << "\n";
+        }
+    }
+    if (!trace_json_path.empty() && !trace_write_chrome_json(trace_json_path)) {
+        std::cerr << "Failed to write trace to " << trace_json_path << "\n";
     }
 }
 
-void move_pointer_to_cell(const std::string& cell_id, int width, int height) {
-    int grid_size = 50;
-    int id_counter = 0;
-    int found_x = -1, found_y = -1;
+// Characters cell labels are built from (--alphabet).
+std::string label_alphabet = default_label_alphabet;
+
+std::vector<Monitor> monitors;  // refreshed on RRScreenChangeNotify
+bool show_all_monitors = true;  // --monitors all|current
+int randr_event_base = -1;      // -1 when XRandR is unavailable
+
+// Layouts are rebuilt only when the monitor configuration changes: one per
+// monitor with --monitors current, a single combined one otherwise.
+std::vector<GridLayout> layouts;
+GridLayout* active_layout = nullptr;  // layout the overlay currently shows
+// With --monitors current, the all-monitors grid the control socket resolves
+// IDs against; built on first use after each rebuild of layouts.
+GridLayout combined_layout;
+bool combined_layout_built = false;
+
+// With --persistent each layout keeps its own overlay window, so a toggle on
+// another monitor maps a different window instead of building a new one.
+// overlay and its pixmaps, GC and shape are those of active_layout; the
+// other layouts' windows are parked here, indexed like layouts.
+struct ParkedOverlay {
+    Window window = 0;
+    Pixmap grid_pixmap = 0;
+    Pixmap back_pixmap = 0;
+    GC gc = 0;
+    std::vector<XRectangle> shape_rects;
+};
+std::vector<ParkedOverlay> parked_overlays;
+int typed_node = 0;  // trie node reached by typed_chars, 0 is the root
+
+// First-level highlight images of cells of active_layout, rendered into
+// backend slots while waiting for the next key, so completing an ID copies
+// one cell instead of drawing it. Least recently used slots are reused.
+const int highlight_cache_slots = 128;
+struct CachedHighlight {
+    int cell = -1;
+    uint64_t last_used = 0;
+};
+std::vector<CachedHighlight> highlight_cache(highlight_cache_slots);
+uint64_t highlight_cache_clock = 0;
+int prerender_next = 0, prerender_end = 0;  // candidate cells still to pre-render
+
+void validate_label_alphabet() {
+    std::string problem = check_label_alphabet(label_alphabet);
+    if (!problem.empty()) {
+        fatal("Invalid --alphabet: " + problem);
+    }
+}
 
-    for (int y = 0; y < height; y += grid_size) {
-        for (int x = 0; x < width; x += grid_size) {
-            std::string cid;
-            if (id_counter < 260) { // 26 * 10
-                cid += 'a' + (id_counter / 10) % 26;
-                cid += '0' + (id_counter % 10);
-            } else {
-                cid += 'a' + ((id_counter - 260) / 26) % 26;
-                cid += 'a' + ((id_counter - 260) % 26);
-            }
+void build_layout(GridLayout& layout, const std::vector<Monitor>& heads) {
+    if (!build_grid_layout(layout, heads, label_alphabet)) {
+        fatal("Alphabet too small for " + std::to_string(layout.cells.size()) + " cells");
+    }
+}
 
-            if (cid == cell_id) {
-                found_x = x + grid_size / 2;
-                found_y = y + grid_size / 2;
-                break;
+void build_layouts();
+
+// Query the active CRTCs, falling back to the whole screen without XRandR,
+// and rebuild the layouts for them.
+void refresh_monitors() {
+    monitors.clear();
+
+    if (randr_event_base != -1) {
+        XRRScreenResources* res = XRRGetScreenResourcesCurrent(display, root);
+        if (res) {
+            for (int i = 0; i < res->ncrtc; ++i) {
+                XRRCrtcInfo* crtc = XRRGetCrtcInfo(display, res, res->crtcs[i]);
+                if (!crtc) continue;
+                if (crtc->mode != None && crtc->noutput > 0) {
+                    Monitor m = {crtc->x, crtc->y, (int)crtc->width, (int)crtc->height};
+                    bool mirrored = false;
+                    for (const Monitor& other : monitors) {
+                        if (other.x == m.x && other.y == m.y &&
+                            other.width == m.width && other.height == m.height) {
+                            mirrored = true;
+                        }
+                    }
+                    if (!mirrored) monitors.push_back(m);
+                }
+                XRRFreeCrtcInfo(crtc);
             }
-            id_counter++;
+            XRRFreeScreenResources(res);
         }
-        if (found_x != -1) break;
     }
 
-    if (found_x != -1 && found_y != -1) {
-        int status = XWarpPointer(display, None, root, 0, 0, 0, 0, found_x, found_y);
-        if (status == BadValue) {
-            std::cerr << "XWarpPointer failed for cell " << cell_id << "\n";
-        }
-        XFlush(display);
+    if (monitors.empty()) {
+        int screen = DefaultScreen(display);
+        monitors.push_back({0, 0, DisplayWidth(display, screen), DisplayHeight(display, screen)});
     }
+
+    // Left to right, then top to bottom, so IDs follow the desk layout.
+    std::sort(monitors.begin(), monitors.end(), [](const Monitor& a, const Monitor& b) {
+        return a.x != b.x ? a.x < b.x : a.y < b.y;
+    });
+
+    build_layouts();
 }
 
-void move_pointer_to_subcell(const std::string& main_cell_id, const std::string& subcell_id, int width, int height) {
-    int grid_size = 50;
-    int id_counter = 0;
-    int cell_x = -1, cell_y = -1;
+void build_layouts() {
+    active_layout = nullptr;
+    combined_layout_built = false;
+    // Callers free the overlays of the old layouts first.
+    parked_overlays.assign(show_all_monitors ? 1 : monitors.size(), {});
+    if (show_all_monitors) {
+        layouts.resize(1);
+        build_layout(layouts[0], monitors);
+    } else {
+        layouts.resize(monitors.size());
+        for (size_t i = 0; i < monitors.size(); ++i) {
+            build_layout(layouts[i], {monitors[i]});
+        }
+    }
+}
 
-    // Find main cell position
-    for (int y = 0; y < height; y += grid_size) {
-        for (int x = 0; x < width; x += grid_size) {
-            std::string cid;
-            if (id_counter < 260) {
-                cid += 'a' + (id_counter / 10) % 26;
-                cid += '0' + (id_counter % 10);
-            } else {
-                cid += 'a' + ((id_counter - 260) / 26) % 26;
-                cid += 'a' + ((id_counter - 260) % 26);
-            }
+// Control IDs always name cells of the all-monitors grid, so they mean the
+// same place whichever monitor the overlay last showed.
+const GridLayout& all_monitors_layout() {
+    if (show_all_monitors) return layouts[0];
+    if (!combined_layout_built) {
+        build_layout(combined_layout, monitors);
+        combined_layout_built = true;
+    }
+    return combined_layout;
+}
 
-            if (cid == main_cell_id) {
-                cell_x = x;
-                cell_y = y;
-                break;
-            }
-            id_counter++;
+// Layout to show for a toggle with the pointer at (x, y) on the root.
+GridLayout* layout_for_pointer(int x, int y) {
+    if (show_all_monitors) return &layouts[0];
+    for (size_t i = 0; i < monitors.size(); ++i) {
+        const Monitor& m = monitors[i];
+        if (x >= m.x && x < m.x + m.width && y >= m.y && y < m.y + m.height) {
+            return &layouts[i];
         }
-        if (cell_x != -1) break;
     }
+    return &layouts[0];
+}
 
-    if (cell_x == -1 || cell_y == -1) return;
+void hide_overlay(bool should_click = false);
 
-    int sub_size = grid_size / 3;
-    int sub_x = -1, sub_y = -1;
+// Start the overlay timeout; a zero timeout still has to expire once.
+void arm_overlay_timer() {
+    itimerspec spec = {};
+    long long ms = overlay_timeout_ms > 0 ? overlay_timeout_ms : 0;
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = (ms % 1000) * 1000000L;
+    if (ms == 0) spec.it_value.tv_nsec = 1;
+    timerfd_settime(overlay_timer_fd, 0, &spec, nullptr);
+}
 
-    std::array<char, 9> subcell_keys = {'g', 'c', 'r', 'h', 't', 'n', 'm', 'w', 'v'};
+void disarm_overlay_timer() {
+    itimerspec spec = {};
+    timerfd_settime(overlay_timer_fd, 0, &spec, nullptr);
+}
 
-    for (int sy = 0; sy < 3; ++sy) {
-        for (int sx = 0; sx < 3; ++sx) {
-            int index = sy * 3 + sx;
-            std::string scid;
-            scid += subcell_keys[index];
+// Pointer actions are queued with a due time and executed by the main loop,
+// so clicks never sleep and several selections can be in flight at once.
+// The queue is kept in due order: new actions never start before the last one.
+enum ActionType { ACTION_WARP, ACTION_BUTTON_PRESS, ACTION_BUTTON_RELEASE };
+
+struct ScheduledAction {
+    std::chrono::steady_clock::time_point due;
+    ActionType type;
+    int button;
+    int x, y;
+};
+
+std::deque<ScheduledAction> action_queue;
+int press_duration_ms = 10;          // time between fake press and release
+int double_click_interval_ms = 100;  // gap between the two clicks of a double click
+
+static std::chrono::steady_clock::time_point next_action_slot() {
+    auto now = std::chrono::steady_clock::now();
+    if (!action_queue.empty() && action_queue.back().due > now) {
+        return action_queue.back().due;
+    }
+    return now;
+}
 
-            if (scid == subcell_id) {
-                sub_x = cell_x + sx * sub_size + sub_size / 2;
-                sub_y = cell_y + sy * sub_size + sub_size / 2;
-                break;
+void run_action(const ScheduledAction& action) {
+    switch (action.type) {
+        case ACTION_WARP: {
+            TraceScope trace(TRACE_WARP);
+            int status = XWarpPointer(display, None, root, 0, 0, 0, 0, action.x, action.y);
+            if (status == BadValue) {
+                std::cerr << "XWarpPointer failed for " << action.x << "," << action.y << "\n";
+            }
+            if (logging_session()) {
+                log_session('A', "warp " + std::to_string(action.x) + " " + std::to_string(action.y));
             }
+            break;
+        }
+        case ACTION_BUTTON_PRESS: {
+            TraceScope trace(TRACE_CLICK);
+            if (!XTestFakeButtonEvent(display, action.button, True, CurrentTime)) {
+                std::cerr << "Failed to fake button press\n";
+            }
+            if (logging_session()) log_session('A', "press " + std::to_string(action.button));
+            break;
+        }
+        case ACTION_BUTTON_RELEASE: {
+            TraceScope trace(TRACE_CLICK);
+            if (!XTestFakeButtonEvent(display, action.button, False, CurrentTime)) {
+                std::cerr << "Failed to fake button release\n";
+            }
+            if (logging_session()) log_session('A', "release " + std::to_string(action.button));
+            break;
         }
-        if (sub_x != -1) break;
     }
+}
 
-    if (sub_x != -1 && sub_y != -1) {
-        int status = XWarpPointer(display, None, root, 0, 0, 0, 0, sub_x, sub_y);
-        if (status == BadValue) {
-            std::cerr << "XWarpPointer failed for subcell " << subcell_id << "\n";
+// Execute every action that is due, with a single flush at the end.
+void run_due_actions() {
+    auto now = std::chrono::steady_clock::now();
+    bool ran = false;
+    while (!action_queue.empty() && action_queue.front().due <= now) {
+        run_action(action_queue.front());
+        action_queue.pop_front();
+        ran = true;
+    }
+    if (ran) {
+        TraceScope trace(TRACE_X_FLUSH);
+        XFlush(display);
+    }
+}
+
+// On exit, send the releases of presses that already ran, so no faked button
+// stays held in the server. Everything else still queued is dropped.
+void release_held_buttons() {
+    int unsent_presses[6] = {};
+    bool ran = false;
+    for (const ScheduledAction& action : action_queue) {
+        if (action.type == ACTION_BUTTON_PRESS) {
+            unsent_presses[action.button]++;
+        } else if (action.type == ACTION_BUTTON_RELEASE) {
+            if (unsent_presses[action.button] > 0) {
+                unsent_presses[action.button]--;
+            } else {
+                run_action(action);
+                ran = true;
+            }
         }
+    }
+    action_queue.clear();
+    if (ran) {
         XFlush(display);
     }
 }
 
-void draw_grid(Window win, int width, int height) {
-    GC gc = XCreateGC(display, win, 0, nullptr);
-    if (!gc) {
-        fatal("Failed to create graphics context");
+// Milliseconds until the next queued action, rounded up; -1 if none.
+int ms_until_next_action() {
+    if (action_queue.empty()) return -1;
+    auto wait = action_queue.front().due - std::chrono::steady_clock::now();
+    auto ms = std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+    return ms > 0 ? (int)ms : 0;
+}
+
+void schedule_warp(int x, int y) {
+    action_queue.push_back({next_action_slot(), ACTION_WARP, 0, x, y});
+    run_due_actions();
+}
+
+void schedule_click(ClickMode mode) {
+    int button = 1;  // default left
+    int click_count = 1;
+
+    switch (mode) {
+        case LEFT_CLICK: button = 1; click_count = 1; break;
+        case RIGHT_CLICK: button = 3; click_count = 1; break;
+        case MIDDLE_CLICK: button = 2; click_count = 1; break;
+        case DOUBLE_CLICK: button = 1; click_count = 2; break;
     }
 
-    XSetForeground(display, gc, WhitePixel(display, DefaultScreen(display)));
+    auto due = next_action_slot();
+    for (int i = 0; i < click_count; ++i) {
+        if (i > 0) due += std::chrono::milliseconds(double_click_interval_ms);
+        action_queue.push_back({due, ACTION_BUTTON_PRESS, button, 0, 0});
+        due += std::chrono::milliseconds(press_duration_ms);
+        action_queue.push_back({due, ACTION_BUTTON_RELEASE, button, 0, 0});
+    }
+    run_due_actions();
+}
 
-    int grid_size = 50;
+// Warp to the centre of a region given in overlay window coordinates, or
+// with --snap to the nearest window centre inside it.
+void move_pointer_to_region(const Rect& region) {
+    Rect on_root = {active_layout->origin_x + region.x, active_layout->origin_y + region.y,
+                    region.width, region.height};
+    int x = on_root.x + on_root.width / 2;
+    int y = on_root.y + on_root.height / 2;
+    if (snap_to_windows) {
+        snap_point(on_root, overlay, x, y);
+    }
+    schedule_warp(x, y);
+}
 
-    int id_counter = 0;
-    for (int y = 0; y < height; y += grid_size) {
-        for (int x = 0; x < width; x += grid_size) {
-            std::string cell_id;
+// Open the label font with Xft, so labels are antialiased and sized in points
+// at the screen's DPI. Without XRender, query the default GC font instead.
+// Either way, every label is measured locally.
+void load_label_font() {
+    int render_event_base, render_error_base;
+    if (XRenderQueryExtension(display, &render_event_base, &render_error_base)) {
+        label_xft_font = XftFontOpenName(display, DefaultScreen(display), label_font_name.c_str());
+        if (label_xft_font) return;
+        std::cerr << "Failed to open font '" << label_font_name << "', using the core font\n";
+    } else {
+        std::cerr << "XRender not available, using the core font for labels\n";
+    }
 
-            if (id_counter < 260) {
-                cell_id += 'a' + (id_counter / 10) % 26;
-                cell_id += '0' + (id_counter % 10);
-            } else {
-                cell_id += 'a' + ((id_counter - 260) / 26) % 26;
-                cell_id += 'a' + ((id_counter - 260) % 26);
-            }
+    GC gc = DefaultGC(display, DefaultScreen(display));
+    label_font = XQueryFont(display, XGContextFromGC(gc));
+    if (!label_font) {
+        std::cerr << "Failed to query label font, labels will not be centered\n";
+    }
+}
 
-            bool is_highlighted = (cell_id == highlighted_cell);
+// Render the unhighlighted grid into grid_pixmap, and start the first frame
+// in back_pixmap from it. Done once per overlay.
+void render_grid_pixmap(int width, int height) {
+    TraceScope trace(TRACE_DRAW_GRID);
+    int depth = DefaultDepth(display, DefaultScreen(display));
+    grid_pixmap = XCreatePixmap(display, overlay, width, height, depth);
+    back_pixmap = XCreatePixmap(display, overlay, width, height, depth);
+    if (!grid_pixmap || !back_pixmap) {
+        fatal("Failed to create grid pixmap");
+    }
 
-            if (is_highlighted) {
-                XSetForeground(display, gc, WhitePixel(display, DefaultScreen(display)));
-                XFillRectangle(display, win, gc, x, y, grid_size, grid_size);
-            }
+    backend->bind(overlay, grid_pixmap, back_pixmap, overlay_gc);
+    render_base_grid(*backend, *active_layout, SURFACE_GRID);
+    backend->reset_frame(width, height);
+}
 
-            XSetForeground(display, gc, WhitePixel(display, DefaultScreen(display)));
-            XDrawLine(display, win, gc, x, y, x, y + grid_size);
-            XDrawLine(display, win, gc, x, y, x + grid_size, y);
+// Copy what the events handled since the last call drew into the window,
+// as one request, so every frame the compositor picks up is complete.
+void present_frame() {
+    if (!overlay || !backend->frame_pending()) return;
+    {
+        TraceScope trace(TRACE_PRESENT);
+        backend->present();
+    }
+    TraceScope trace(TRACE_X_FLUSH);
+    XFlush(display);
+}
 
-            int cx = x + grid_size / 2;
-            int cy = y + grid_size / 2;
+// With --shaped, the window's bounding shape covers only the grid lines, the
+// visible labels and the highlighted cell, so the compositor blends a small
+// part of the screen instead of all of it.
+std::vector<XRectangle> grid_shape_rects;  // lines and labels of the unhighlighted grid
 
-            int direction, ascent, descent;
-            XCharStruct overall;
-            XFontStruct *font = XQueryFont(display, XGContextFromGC(gc));
-            if (font) {
-                XTextExtents(font, cell_id.c_str(), 2, &direction, &ascent, &descent, &overall);
-                cx -= overall.width / 2;
-                cy += (ascent - descent) / 2;
-            }
+static XRectangle to_xrect(const Rect& r) {
+    return {(short)r.x, (short)r.y, (unsigned short)r.width, (unsigned short)r.height};
+}
 
-            // Use bright color for main cell text
-            XSetForeground(display, gc, bright_pixel);
-            XDrawString(display, win, gc, cx, cy, cell_id.c_str(), 2);
+void build_grid_shape() {
+    grid_shape_rects.clear();
+    for (const GridBlock& block : active_layout->blocks) {
+        for (int c = 0; c < block.cols; ++c) {
+            grid_shape_rects.push_back({(short)(block.x + c * grid_size), (short)block.y,
+                                        1, (unsigned short)block.height});
+        }
+        for (int r = 0; r < block.rows; ++r) {
+            grid_shape_rects.push_back({(short)block.x, (short)(block.y + r * grid_size),
+                                        (unsigned short)block.width, 1});
+        }
+    }
+    for (const GridCell& cell : active_layout->cells) {
+        grid_shape_rects.push_back(to_xrect(label_rect(*backend, cell)));
+    }
+}
 
-            bool show_subgrid = false;
-            if (is_highlighted) {
-                if (highlighted_subcell != "" || (typed_chars.length() == 2 && highlighted_cell == typed_chars)) {
-                    show_subgrid = true;
-                }
-            }
+void apply_grid_shape() {
+    XShapeCombineRectangles(display, overlay, ShapeBounding, 0, 0,
+                            grid_shape_rects.data(), (int)grid_shape_rects.size(),
+                            ShapeSet, Unsorted);
+}
 
-            if (show_subgrid) {
-                int sub_size = grid_size / 3;
-                std::array<char, 9> subcell_keys = {'g', 'c', 'r', 'h', 't', 'n', 'm', 'w', 'v'};
-                for (int sy = 0; sy < 3; ++sy) {
-                    for (int sx = 0; sx < 3; ++sx) {
-                        int sub_x = x + sx * sub_size;
-                        int sub_y = y + sy * sub_size;
+static void shape_combine(std::vector<XRectangle>& rects, int op) {
+    if (rects.empty()) return;
+    XShapeCombineRectangles(display, overlay, ShapeBounding, 0, 0,
+                            rects.data(), (int)rects.size(), op, Unsorted);
+}
 
-                        int index = sy * 3 + sx;
-                        std::string scid;
-                        scid += subcell_keys[index];
+// Blank the inside of the given cells, keeping the grid lines, so only cells
+// whose ID still matches the typed prefix show a label.
+void dim_cells(const std::vector<int>& cell_indices) {
+    if (cell_indices.empty()) return;
 
-                        bool sub_highlight = (highlighted_subcell != "" && scid == highlighted_subcell);
+    render_dimmed_cells(*backend, *active_layout, SURFACE_WINDOW, cell_indices);
 
-                        if (sub_highlight) {
-                            XSetForeground(display, gc, WhitePixel(display, DefaultScreen(display)));
-                            XFillRectangle(display, win, gc, sub_x, sub_y, sub_size, sub_size);
-                        }
+    if (shaped_overlay) {
+        std::vector<XRectangle> rects;
+        rects.reserve(cell_indices.size());
+        for (int i : cell_indices) {
+            rects.push_back(to_xrect(label_rect(*backend, active_layout->cells[i])));
+        }
+        shape_combine(rects, ShapeSubtract);
+    }
+}
 
-                        XSetForeground(display, gc, WhitePixel(display, DefaultScreen(display)));
-                        XDrawLine(display, win, gc, sub_x, sub_y, sub_x + sub_size, sub_y);
-                        XDrawLine(display, win, gc, sub_x, sub_y, sub_x, sub_y + sub_size);
+std::vector<int> dimmed_scratch;  // reused by every dimming pass
 
-                        int scx = sub_x + sub_size / 2;
-                        int scy = sub_y + sub_size / 2;
+int cached_highlight_slot(int cell_index) {
+    for (int slot = 0; slot < highlight_cache_slots; ++slot) {
+        if (highlight_cache[slot].cell == cell_index) return slot;
+    }
+    return -1;
+}
 
-                        if (font) {
-                            XTextExtents(font, scid.c_str(), 1, &direction, &ascent, &descent, &overall);
-                            scx -= overall.width / 2;
-                            scy += (ascent - descent) / 2;
-                        }
+void clear_highlight_cache() {
+    for (CachedHighlight& entry : highlight_cache) entry = {};
+    prerender_next = prerender_end = 0;
+}
 
-                        if (is_highlighted) {
-                            XSetForeground(display, gc, dark_pixel);
-                        } else {
-                            XSetForeground(display, gc, orange_pixel);
-                        }
-                        XDrawString(display, win, gc, scx, scy, scid.c_str(), 1);
-                    }
-                }
-            }
+// Pre-render the candidates below node once there are few enough of them
+// to all fit in the cache, and only when their key labels fit in the cell
+// (otherwise the highlight comes with a key map drawn outside it).
+void queue_prerender(int node) {
+    int count = active_layout->node_count[node];
+    const GridCell& any_cell = active_layout->cells[active_layout->node_first[node]];
+    if (count > highlight_cache_slots ||
+        !zoom_labels_fit(*backend, cell_rect(any_cell), zoom_dim(zoom_config.keys_for(0)))) {
+        prerender_next = prerender_end = 0;
+        return;
+    }
+    prerender_next = active_layout->node_first[node];
+    prerender_end = prerender_next + count;
+    // Keep cached candidates from being evicted for the others.
+    for (int i = prerender_next; i < prerender_end; ++i) {
+        int slot = cached_highlight_slot(i);
+        if (slot != -1) highlight_cache[slot].last_used = ++highlight_cache_clock;
+    }
+}
+
+// Render queued highlight images until input or a due pointer action is
+// waiting, so pre-rendering never delays the next key.
+void prerender_while_idle() {
+    if (prerender_next == prerender_end) return;
+    TraceScope trace(TRACE_PRERENDER);
+    const std::string& keys = zoom_config.keys_for(0);
+    while (prerender_next < prerender_end) {
+        if (XEventsQueued(display, QueuedAfterReading) > 0 || ms_until_next_action() == 0) break;
+        int cell_index = prerender_next++;
+        if (cached_highlight_slot(cell_index) != -1) continue;
+
+        int slot = 0;
+        for (int i = 1; i < highlight_cache_slots; ++i) {
+            if (highlight_cache[i].last_used < highlight_cache[slot].last_used) slot = i;
+        }
+        Rect area = cell_rect(active_layout->cells[cell_index]);
+        backend->begin_slot(slot, area);
+        render_highlighted_cell(*backend, *active_layout, SURFACE_WINDOW, cell_index,
+                                {area, keys.c_str(), zoom_dim(keys), {}});
+        backend->end_slot();
+        highlight_cache[slot] = {cell_index, ++highlight_cache_clock};
+    }
+    XFlush(display);
+}
+
+// Typing moved from one trie node to a child. Candidates form a contiguous
+// range that only shrinks, so the cells to dim are the two trimmed ends.
+void narrow_candidates(int old_node, int new_node) {
+    queue_prerender(new_node);
+    TraceScope trace(TRACE_DRAW_UPDATE);
+    trimmed_candidates(*active_layout, old_node, new_node, dimmed_scratch);
+    dim_cells(dimmed_scratch);
+}
 
-            id_counter++;
+ZoomView current_zoom_view() {
+    const std::string& keys = zoom_config.keys_for(zoom_level);
+    return {zoom_region, keys.c_str(), zoom_dim(keys), zoom_legend};
+}
+
+// Make region the one the next zoom key splits. The key map appears once
+// labels stop fitting and then stays put, sized for the largest level, so
+// moving down a level never has to restore anything around the cell.
+void set_zoom_region(const Rect& region, int level) {
+    zoom_region = region;
+    zoom_level = level;
+    int dim = zoom_dim(zoom_config.keys_for(level));
+    if (zoom_legend.width == 0 && !zoom_labels_fit(*backend, region, dim)) {
+        zoom_legend = zoom_legend_rect(*backend, *active_layout, active_layout->cells[highlighted_cell],
+                                       zoom_max_dim);
+        if (shaped_overlay) {
+            std::vector<XRectangle> rects = {to_xrect(zoom_legend)};
+            shape_combine(rects, ShapeUnion);
+        }
+    }
+}
+
+// Change the highlighted cell, repainting only the affected cells.
+void update_highlight(int cell_index, int subcell_index) {
+    TraceScope trace(TRACE_DRAW_UPDATE);
+    int old_cell = highlighted_cell;
+    highlighted_cell = cell_index;
+    highlighted_subcell = subcell_index;
+
+    if (old_cell != -1 && old_cell != cell_index) {
+        const GridCell& cell = active_layout->cells[old_cell];
+        backend->copy_area(SURFACE_GRID, SURFACE_WINDOW, cell_rect(cell));
+        if (shaped_overlay) {
+            std::vector<XRectangle> rects = {to_xrect(cell_rect(cell))};
+            shape_combine(rects, ShapeSubtract);
+            rects = {{(short)cell.x, (short)cell.y, 1, (unsigned short)grid_size},
+                     {(short)cell.x, (short)cell.y, (unsigned short)grid_size, 1},
+                     to_xrect(label_rect(*backend, cell))};
+            shape_combine(rects, ShapeUnion);
+        }
+    }
+    if (cell_index != -1) {
+        if (cell_index != old_cell) {
+            set_zoom_region(cell_rect(active_layout->cells[cell_index]), 0);
         }
+        int slot = zoom_legend.width == 0 ? cached_highlight_slot(cell_index) : -1;
+        if (slot != -1) {
+            highlight_cache[slot].last_used = ++highlight_cache_clock;
+            backend->copy_from_slot(slot, cell_rect(active_layout->cells[cell_index]));
+        } else {
+            render_highlighted_cell(*backend, *active_layout, SURFACE_WINDOW, cell_index,
+                                    current_zoom_view());
+        }
+        if (shaped_overlay) {
+            std::vector<XRectangle> rects = {to_xrect(cell_rect(active_layout->cells[cell_index]))};
+            shape_combine(rects, ShapeUnion);
+        }
+    }
+}
+
+// A zoom key picked a part of the current region: warp there, then either
+// split that part at the next level, repainting just the cell and key map,
+// or click once the configured depth is reached or it is too small to split.
+void select_zoom_part(int part) {
+    int dim = zoom_dim(zoom_config.keys_for(zoom_level));
+    Rect next = zoom_part(zoom_region, dim, part);
+    highlighted_subcell = part;
+    move_pointer_to_region(next);
+
+    int next_level = zoom_level + 1;
+    if (next_level < zoom_config.depth &&
+        zoom_can_split(next, zoom_dim(zoom_config.keys_for(next_level)))) {
+        TraceScope trace(TRACE_DRAW_UPDATE);
+        set_zoom_region(next, next_level);
+        render_highlighted_cell(*backend, *active_layout, SURFACE_WINDOW, highlighted_cell,
+                                current_zoom_view());
+    } else {
+        hide_overlay(true);
     }
+}
 
-    XFreeGC(display, gc);
+static void free_window_resources(Window& window, Pixmap& grid, Pixmap& back, GC& gc) {
+    if (grid) {
+        XFreePixmap(display, grid);
+        grid = 0;
+    }
+    if (back) {
+        XFreePixmap(display, back);
+        back = 0;
+    }
+    if (gc) {
+        XFreeGC(display, gc);
+        gc = 0;
+    }
+    if (window) {
+        (void)XDestroyWindow(display, window);
+        window = 0;
+    }
 }
 
-void create_overlay() {
+// Free the current overlay and every parked one.
+void free_overlay_resources() {
+    if (backend) {
+        backend->unbind();
+    }
+    free_window_resources(overlay, grid_pixmap, back_pixmap, overlay_gc);
+    for (ParkedOverlay& parked : parked_overlays) {
+        free_window_resources(parked.window, parked.grid_pixmap, parked.back_pixmap, parked.gc);
+        parked.shape_rects.clear();
+    }
+}
+
+// Set the unmapped current overlay aside for its layout's next show. Its
+// back buffer was already reset to the plain grid when it was hidden.
+void park_overlay() {
+    if (!overlay) return;
+    backend->unbind();
+    ParkedOverlay& parked = parked_overlays[active_layout - layouts.data()];
+    parked.window = overlay;
+    parked.grid_pixmap = grid_pixmap;
+    parked.back_pixmap = back_pixmap;
+    parked.gc = overlay_gc;
+    parked.shape_rects.swap(grid_shape_rects);
+    grid_shape_rects.clear();
+    overlay = 0;
+    grid_pixmap = back_pixmap = 0;
+    overlay_gc = 0;
+    active_layout = nullptr;
+}
+
+// Make layout's parked overlay the current one. Returns false if it has none.
+bool unpark_overlay(GridLayout* layout) {
+    ParkedOverlay& parked = parked_overlays[layout - layouts.data()];
+    if (!parked.window) return false;
+    active_layout = layout;
+    clear_highlight_cache();
+    overlay = parked.window;
+    grid_pixmap = parked.grid_pixmap;
+    back_pixmap = parked.back_pixmap;
+    overlay_gc = parked.gc;
+    grid_shape_rects.swap(parked.shape_rects);
+    parked = {};
+    backend->bind(overlay, grid_pixmap, back_pixmap, overlay_gc);
+    return true;
+}
+
+// Create the (unmapped) overlay window with its GC and the grid of layout.
+void create_overlay(GridLayout* layout) {
+    TraceScope trace(TRACE_CREATE_OVERLAY);
     int screen = DefaultScreen(display);
     root = RootWindow(display, screen);
 
-    int width = DisplayWidth(display, screen);
-    int height = DisplayHeight(display, screen);
+    active_layout = layout;
+    clear_highlight_cache();
+    int width = layout->width;
+    int height = layout->height;
 
     XSetWindowAttributes attrs;
     attrs.override_redirect = True;
     attrs.background_pixel = 0;
     attrs.border_pixel = 0;
-    overlay = XCreateWindow(display, root, 0, 0, width, height, 0,
+    overlay = XCreateWindow(display, root, layout->origin_x, layout->origin_y, width, height, 0,
                             DefaultDepth(display, screen),
                             InputOutput,
                             DefaultVisual(display, screen),
@@ -289,64 +818,122 @@ void create_overlay() {
     }
 
     unsigned long opacity = 0x80000000;
-    Atom property = XInternAtom(display, "_NET_WM_WINDOW_OPACITY", False);
-    Atom cardinal_atom = XInternAtom(display, "CARDINAL", False);
-    (void)XChangeProperty(display, overlay, property, cardinal_atom, 32, PropModeReplace,
+    (void)XChangeProperty(display, overlay, opacity_atom, cardinal_atom, 32, PropModeReplace,
                     (unsigned char *)&opacity, 1);
 
-    (void)XSelectInput(display, overlay, ExposureMask | KeyPressMask);
-    (void)XMapRaised(display, overlay);
-    XFlush(display);
+    (void)XSelectInput(display, overlay, ExposureMask | KeyPressMask | KeyReleaseMask);
 
-    (void)XSetInputFocus(display, overlay, RevertToParent, CurrentTime);
+    overlay_gc = XCreateGC(display, overlay, 0, nullptr);
+    if (!overlay_gc) {
+        fatal("Failed to create graphics context");
+    }
+
+    render_grid_pixmap(width, height);
+    if (shaped_overlay) {
+        build_grid_shape();
+        apply_grid_shape();
+    }
 
-    draw_grid(overlay, width, height);
+    // Let the server paint the current frame itself whenever the window is
+    // mapped or exposed.
+    (void)XSetWindowBackgroundPixmap(display, overlay, back_pixmap);
 }
 
-void click_pointer(ClickMode mode) {
-    int button = 1;  // default left
-    int click_count = 1;
+// Create the overlay of every layout up front, leaving the first current.
+void prewarm_overlays() {
+    for (size_t i = layouts.size(); i-- > 0;) {
+        park_overlay();
+        create_overlay(&layouts[i]);
+    }
+}
 
-    switch (mode) {
-        case LEFT_CLICK: button = 1; click_count = 1; break;
-        case RIGHT_CLICK: button = 3; click_count = 1; break;
-        case MIDDLE_CLICK: button = 2; click_count = 1; break;
-        case DOUBLE_CLICK: button = 1; click_count = 2; break;
+// Show the grid for the monitor containing (pointer_x, pointer_y), or for all
+// monitors. Persistent overlays are kept per layout, so switching monitors
+// only swaps which window gets mapped.
+void show_overlay(int pointer_x, int pointer_y) {
+    GridLayout* layout = layout_for_pointer(pointer_x, pointer_y);
+    if (overlay && layout != active_layout) {
+        park_overlay();
+    }
+    if (!overlay && !unpark_overlay(layout)) {
+        create_overlay(layout);
     }
 
-    for (int i = 0; i < click_count; ++i) {
-        if (!XTestFakeButtonEvent(display, button, True, CurrentTime)) {
-            std::cerr << "Failed to fake button press\n";
-        }
-        XFlush(display);
-        usleep(10000);
-        if (!XTestFakeButtonEvent(display, button, False, CurrentTime)) {
-            std::cerr << "Failed to fake button release\n";
-        }
+    (void)XMapRaised(display, overlay);
+    log_session('A', "map");
+    (void)XSetInputFocus(display, overlay, RevertToParent, CurrentTime);
+    {
+        TraceScope trace(TRACE_X_FLUSH);
         XFlush(display);
-        if (click_count == 2) usleep(100000);  // small delay between double clicks
     }
+
+    overlayVisible = true;
+    arm_overlay_timer();
 }
 
-void destroy_overlay(bool should_click) {
-    if (overlay) {
+// Hide the overlay and reset selection state. In persistent mode the window,
+// GC and grid pixmap are kept for the next toggle; otherwise they are freed.
+void hide_overlay(bool should_click) {
+    if (overlayVisible) {
         (void)XSetInputFocus(display, root, RevertToParent, CurrentTime);
 
-        (void)XDestroyWindow(display, overlay);
-        overlay = 0;
-        highlighted_cell = "";
-        highlighted_subcell = "";
+        disarm_overlay_timer();
+        log_session('A', "unmap");
+        if (persistent_overlay) {
+            (void)XUnmapWindow(display, overlay);
+            backend->reset_frame(active_layout->width, active_layout->height);
+            if (shaped_overlay) {
+                apply_grid_shape();  // drop highlight and dimming for the next show
+            }
+        } else {
+            free_overlay_resources();
+        }
+        highlighted_cell = -1;
+        highlighted_subcell = -1;
+        zoom_level = 0;
+        zoom_legend = {};
         typed_chars = "";
+        typed_node = 0;
+        prerender_next = prerender_end = 0;
+
+        // Releases of keys typed into the overlay go elsewhere once it is
+        // hidden; forget them so they cannot complete a chord later.
+        keys_down.reset();
 
         overlayVisible = false;
 
         if (should_click) {
-            click_pointer(current_click_mode);
+            schedule_click(current_click_mode);
+        }
+    }
+}
+
+// Grabs are sent without waiting for a reply. Each one's serial is kept so
+// an error can be matched to its key once a later round trip has brought
+// all errors in; until then grab_error_handler collects them.
+struct PendingGrab {
+    unsigned long serial;
+    std::string key;
+    unsigned int modifiers;
+    bool failed;
+};
+std::vector<PendingGrab> pending_grabs;
+XErrorHandler default_error_handler = nullptr;
+
+int grab_error_handler(Display *disp, XErrorEvent *error) {
+    if (error->request_code == X_GrabKey) {
+        for (PendingGrab& grab : pending_grabs) {
+            if (grab.serial == error->serial) {
+                grab.failed = true;
+                return 0;
+            }
         }
     }
+    return default_error_handler(disp, error);
 }
 
-void grab_key_with_modifiers(Display *disp, Window win, int keycode, int base_mods) {
+void grab_key_with_modifiers(Display *disp, Window win, int keycode, int base_mods,
+                             const std::string& name) {
     unsigned int modifiers[] = {
         0,
         Mod2Mask,
@@ -355,199 +942,672 @@ void grab_key_with_modifiers(Display *disp, Window win, int keycode, int base_mo
     };
 
     for (unsigned int mod : modifiers) {
-        int result = XGrabKey(disp, keycode, base_mods | mod, win, True, GrabModeAsync, GrabModeAsync);
-        if (result == 0) {
-            std::cerr << "Warning: failed to grab key with modifiers mask " << (base_mods | mod) << "\n";
+        pending_grabs.push_back({NextRequest(disp), name, base_mods | mod, false});
+        XGrabKey(disp, keycode, base_mods | mod, win, True, GrabModeAsync, GrabModeAsync);
+    }
+}
+
+static unsigned long scale_channel(unsigned int value, unsigned long mask) {
+    int shift = 0;
+    while (shift < 32 && !((mask >> shift) & 1)) ++shift;
+    unsigned long max = mask >> shift;
+    return ((value * max + 127) / 255) << shift;
+}
+
+// Pixel for an 0xRRGGBB colour. On TrueColor visuals it follows from the
+// channel masks without asking the server; otherwise it is allocated.
+unsigned long rgb_pixel(uint32_t rgb, unsigned long fallback, const char* name, const char* fallback_name) {
+    int screen = DefaultScreen(display);
+    Visual* visual = DefaultVisual(display, screen);
+    unsigned int r = rgb >> 16 & 0xff, g = rgb >> 8 & 0xff, b = rgb & 0xff;
+    if (visual->c_class == TrueColor) {
+        return scale_channel(r, visual->red_mask) | scale_channel(g, visual->green_mask) |
+               scale_channel(b, visual->blue_mask);
+    }
+
+    XColor color;
+    color.red = r * 0x101;
+    color.green = g * 0x101;
+    color.blue = b * 0x101;
+    color.flags = DoRed | DoGreen | DoBlue;
+    if (!XAllocColor(display, DefaultColormap(display, screen), &color)) {
+        std::cerr << "Failed to allocate " << name << " color, using " << fallback_name << " instead\n";
+        return fallback;
+    }
+    return color.pixel;
+}
+
+bool is_chord_key(KeyCode keycode) {
+    for (KeyCode k : chord_keycodes) {
+        if (k == keycode) return true;
+    }
+    return false;
+}
+
+// Replace keys_down with the server's view of the keyboard.
+void sync_keys_down() {
+    char keys[32];
+    XQueryKeymap(display, keys);
+    for (int i = 0; i < 256; ++i) {
+        keys_down[i] = (keys[i / 8] >> (i % 8)) & 1;
+    }
+}
+
+bool chord_held() {
+    for (KeyCode k : chord_keycodes) {
+        if (!keys_down.test(k)) return false;
+    }
+    return true;
+}
+
+void handle_event(XEvent& ev) {
+    if (ev.type == KeyRelease) {
+        keys_down.reset(ev.xkey.keycode);
+        if (is_chord_key(ev.xkey.keycode)) {
+            toggle_in_progress = false;
+        }
+        return;
+    }
+
+    if (ev.type == KeyPress) {
+        XKeyEvent xkey = ev.xkey;
+        KeySym keysym = XLookupKeysym(&xkey, 0);
+
+        bool ctrl_held = (xkey.state & ControlMask) == ControlMask;
+
+        if (ctrl_held && is_chord_key(xkey.keycode)) {
+            // A passive grab just activated: keys pressed or released while
+            // another client had the keyboard never reached us.
+            sync_keys_down();
+        }
+        keys_down.set(xkey.keycode);
+
+        bool chord_pressed;
+        {
+            TraceScope trace(TRACE_CHORD);
+            chord_pressed = ctrl_held && chord_held();
+        }
+
+        if (chord_pressed) {
+            if (!toggle_in_progress) {
+                if (overlayVisible) {
+                    hide_overlay();
+                } else {
+                    show_overlay(xkey.x_root, xkey.y_root);
+                }
+                toggle_in_progress = true;
+            }
+        } else {
+            toggle_in_progress = false;
+        }
+
+        if (overlayVisible && ev.xkey.window == overlay) {
+            // Change click mode with Ctrl+number
+            if (ctrl_held) {
+                if (keysym == XK_1) {
+                    current_click_mode = LEFT_CLICK;
+                    return;
+                } else if (keysym == XK_2) {
+                    current_click_mode = RIGHT_CLICK;
+                    return;
+                } else if (keysym == XK_3) {
+                    current_click_mode = MIDDLE_CLICK;
+                    return;
+                } else if (keysym == XK_4) {
+                    current_click_mode = DOUBLE_CLICK;
+                    return;
+                }
+            }
+
+            if (keysym == XK_Escape) {
+                hide_overlay();
+                return;
+            }
+
+            if ((keysym == XK_Return || keysym == XK_KP_Enter)) {
+                if (highlighted_cell != -1) {
+                    move_pointer_to_region(zoom_region);
+                }
+                hide_overlay(true);
+                return;
+            }
+
+            char buf[32];
+            int len = XLookupString(&xkey, buf, sizeof(buf), &keysym, nullptr);
+            if (len == 1 && std::isalnum(buf[0])) {
+                char c = std::tolower(buf[0]);
+                if (highlighted_cell == -1) {
+                    // Still narrowing down the cell; keys no label continues with are ignored.
+                    int node = trie_step(*active_layout, typed_node, c);
+                    if (node == -1) return;
+                    typed_chars += c;
+                    narrow_candidates(typed_node, node);
+                    typed_node = node;
+
+                    int cell = resolved_cell(*active_layout, node);
+                    if (cell != -1) {
+                        update_highlight(cell, -1);
+                        move_pointer_to_region(zoom_region);
+                    }
+                } else {
+                    int part = zoom_key_index(zoom_config.keys_for(zoom_level), c);
+                    if (part != -1) {
+                        typed_chars += c;
+                        select_zoom_part(part);
+                    }
+                }
+            }
+        }
+    } else if (snap_to_windows && snap_handle_event(ev)) {
+        // Window geometry for --snap; nothing else to do.
+    } else if (randr_event_base != -1 && ev.type == randr_event_base + RRScreenChangeNotify) {
+        // Monitors were added, removed or moved: start over with fresh layouts.
+        XRRUpdateConfiguration(&ev);
+        if (snap_to_windows) {
+            int screen = DefaultScreen(display);
+            snap_resize(DisplayWidth(display, screen), DisplayHeight(display, screen));
+        }
+        hide_overlay();
+        free_overlay_resources();
+        refresh_monitors();
+        if (persistent_overlay) {
+            prewarm_overlays();
         }
+    } else if (ev.type == Expose && overlayVisible && ev.xexpose.window == overlay) {
+        // The server may have painted the background from an older copy of
+        // back_pixmap; the frame itself is always complete there.
+        backend->expose({ev.xexpose.x, ev.xexpose.y, ev.xexpose.width, ev.xexpose.height});
     }
 }
 
+void log_input(const XEvent& ev) {
+    if (!logging_session() || (ev.type != KeyPress && ev.type != KeyRelease)) return;
+    XKeyEvent xkey = ev.xkey;
+    KeySym keysym = XLookupKeysym(&xkey, 0);
+    char body[128];
+    std::snprintf(body, sizeof(body), "key %d %u 0x%lx %u %d %d %d",
+                  ev.type == KeyPress, xkey.keycode, (unsigned long)keysym, xkey.state,
+                  xkey.x_root, xkey.y_root, overlay && xkey.window == overlay);
+    log_session('E', body);
+}
+
+// Log the selection state if the last input changed it.
+void log_state() {
+    if (!logging_session()) return;
+    std::string state = std::to_string(overlayVisible) + " " +
+                        (typed_chars.empty() ? "-" : typed_chars) + " " +
+                        std::to_string(highlighted_cell) + " " +
+                        std::to_string(highlighted_subcell) + " " +
+                        std::to_string(current_click_mode);
+    if (state != last_logged_state) {
+        last_logged_state = state;
+        log_session('S', state);
+    }
+}
+
+// Feed the inputs of a recorded session back through handle_event, either
+// back to back or at their recorded times, then compare what happened with
+// the recording. Key events are synthesized locally; everything they cause
+// (drawing, warps, clicks) goes to the X server as in a live session.
+bool replay_session(const SessionLog& log, bool original_timing) {
+    replaying = true;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t first_ns = 0;
+    for (const SessionEntry& entry : log.entries) {
+        if (entry.kind == 'E') {
+            first_ns = entry.t_ns;
+            break;
+        }
+    }
+
+    for (const SessionEntry& entry : log.entries) {
+        if (entry.kind != 'E') continue;
+
+        if (original_timing) {
+            auto due = start + std::chrono::nanoseconds(entry.t_ns - first_ns);
+            while (std::chrono::steady_clock::now() < due) {
+                auto wait = due - std::chrono::steady_clock::now();
+                int action_ms = ms_until_next_action();
+                if (action_ms >= 0 && std::chrono::milliseconds(action_ms) < wait) {
+                    wait = std::chrono::milliseconds(action_ms);
+                }
+                usleep((useconds_t)std::chrono::duration_cast<std::chrono::microseconds>(wait).count());
+                run_due_actions();
+            }
+        }
+
+        if (entry.body == "timeout") {
+            log_session('E', "timeout");
+            hide_overlay();
+        } else {
+            int press, x_root, y_root, to_overlay;
+            unsigned int keycode, state;
+            unsigned long keysym;
+            if (std::sscanf(entry.body.c_str(), "key %d %u 0x%lx %u %d %d %d", &press, &keycode,
+                            &keysym, &state, &x_root, &y_root, &to_overlay) != 7) {
+                std::cerr << "Skipping malformed input: " << entry.body << "\n";
+                continue;
+            }
+            // Keycodes differ between keyboards; the keysym is what was meant.
+            KeyCode local = XKeysymToKeycode(display, keysym);
+            XEvent ev = {};
+            ev.type = press ? KeyPress : KeyRelease;
+            ev.xkey.display = display;
+            ev.xkey.window = to_overlay && overlay ? overlay : root;
+            ev.xkey.root = root;
+            ev.xkey.keycode = local ? local : keycode;
+            ev.xkey.state = state;
+            ev.xkey.x_root = x_root;
+            ev.xkey.y_root = y_root;
+            ev.xkey.same_screen = True;
+            log_input(ev);
+            handle_event(ev);
+        }
+        log_state();
+        present_frame();
+        run_due_actions();
+
+        // Keep up with Expose and other server events, but not real key presses.
+        while (XPending(display)) {
+            XEvent ev;
+            XNextEvent(display, &ev);
+            if (ev.type != KeyPress && ev.type != KeyRelease) {
+                handle_event(ev);
+            }
+        }
+    }
+
+    // Let clicks that are still queued finish so they can be compared.
+    while (!action_queue.empty()) {
+        usleep(ms_until_next_action() * 1000);
+        run_due_actions();
+    }
+    XSync(display, False);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    replaying = false;
+    return compare_sessions(log, replay_capture, seconds, std::cout);
+}
+
 int main(int argc, char* argv[]) {
+    std::string record_path;
+    std::string replay_path;
+    bool replay_original_timing = false;
+
+    // Parse command‑line arguments
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--timeout" && i + 1 < argc) {
+            overlay_timeout_seconds = std::stoi(argv[i + 1]);
+            overlay_timeout_ms = overlay_timeout_seconds * 1000;
+            ++i; // skip the value we just consumed
+        } else if (std::string(argv[i]) == "--wakeup-stats") {
+            report_wakeups = true;
+        } else if (std::string(argv[i]) == "--stats-file" && i + 1 < argc) {
+            stats_file_path = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "--control-socket" && i + 1 < argc) {
+            control_socket_path = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "--record" && i + 1 < argc) {
+            record_path = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "--replay" && i + 1 < argc) {
+            replay_path = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "--replay-timing" && i + 1 < argc) {
+            std::string timing = argv[i + 1];
+            if (timing == "fast") {
+                replay_original_timing = false;
+            } else if (timing == "original") {
+                replay_original_timing = true;
+            } else {
+                fatal("--replay-timing must be 'fast' or 'original'");
+            }
+            ++i;
+        } else if (std::string(argv[i]) == "--trace-json" && i + 1 < argc) {
+            trace_json_path = argv[i + 1];
+            trace_enable_spans();
+            ++i;
+        } else if (std::string(argv[i]) == "--press-ms" && i + 1 < argc) {
+            press_duration_ms = std::stoi(argv[i + 1]);
+            ++i;
+        } else if (std::string(argv[i]) == "--double-click-ms" && i + 1 < argc) {
+            double_click_interval_ms = std::stoi(argv[i + 1]);
+            ++i;
+        } else if (std::string(argv[i]) == "--alphabet" && i + 1 < argc) {
+            label_alphabet = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "--zoom-keys" && i + 1 < argc) {
+            zoom_config.keys.clear();
+            std::stringstream levels(argv[i + 1]);
+            std::string keys;
+            while (std::getline(levels, keys, ',')) {
+                std::string problem = check_zoom_keys(keys);
+                if (!problem.empty()) {
+                    fatal("Invalid --zoom-keys level '" + keys + "': " + problem);
+                }
+                zoom_config.keys.push_back(keys);
+            }
+            if (zoom_config.keys.empty()) {
+                fatal("--zoom-keys needs at least one level, e.g. --zoom-keys gcrhtnmwv");
+            }
+            ++i;
+        } else if (std::string(argv[i]) == "--zoom-depth" && i + 1 < argc) {
+            std::string depth = argv[i + 1];
+            if (depth == "auto") {
+                zoom_depth_auto = true;
+            } else {
+                zoom_config.depth = std::stoi(depth);
+                if (zoom_config.depth < 1) fatal("--zoom-depth must be 'auto' or at least 1");
+            }
+            ++i;
+        } else if (std::string(argv[i]) == "--monitors" && i + 1 < argc) {
+            std::string mode = argv[i + 1];
+            if (mode == "all") {
+                show_all_monitors = true;
+            } else if (mode == "current") {
+                show_all_monitors = false;
+            } else {
+                fatal("--monitors must be 'all' or 'current'");
+            }
+            ++i;
+        } else if (std::string(argv[i]) == "--font" && i + 1 < argc) {
+            label_font_name = argv[i + 1];
+            ++i;
+        } else if (std::string(argv[i]) == "--startup-profile") {
+            startup_profile = true;
+        } else if (std::string(argv[i]) == "--snap") {
+            snap_to_windows = true;
+        } else if (std::string(argv[i]) == "--shaped") {
+            shaped_overlay = true;
+        } else if (std::string(argv[i]) == "--persistent") {
+            persistent_overlay = true;
+        } else if (std::string(argv[i]) == "--chord" && i + 1 < argc) {
+            chord_key_names.clear();
+            std::string spec = argv[i + 1];
+            size_t start = 0;
+            while (start <= spec.size()) {
+                size_t plus = spec.find('+', start);
+                if (plus == std::string::npos) plus = spec.size();
+                if (plus > start) chord_key_names.push_back(spec.substr(start, plus - start));
+                start = plus + 1;
+            }
+            if (chord_key_names.empty()) {
+                fatal("--chord needs at least one key, e.g. --chord h+t");
+            }
+            ++i;
+        }
+    }
+
+    validate_label_alphabet();
+
+    startup_phase_start = trace_now();
     display = XOpenDisplay(nullptr);
     if (!display) {
         std::cerr << "Unable to open X display\n";
         return 1;
     }
+    startup_phase_done("connect");
 
     root = DefaultRootWindow(display);
 
-    Colormap cmap = DefaultColormap(display, DefaultScreen(display));
-    XColor color;
-    if (!XParseColor(display, cmap, "#FFA500", &color) || !XAllocColor(display, cmap, &color)) {
-        std::cerr << "Failed to allocate orange color, using black instead\n";
-        orange_pixel = BlackPixel(display, DefaultScreen(display));
-    } else {
-        orange_pixel = color.pixel;
+    if (zoom_depth_auto) {
+        int screen = DefaultScreen(display);
+        int width_mm = DisplayWidthMM(display, screen);
+        // Servers that do not know the physical size report 0; assume 96 DPI.
+        double px_per_mm = width_mm > 0 ? (double)DisplayWidth(display, screen) / width_mm : 96 / 25.4;
+        zoom_config.depth = auto_zoom_depth(zoom_config, px_per_mm);
+    }
+    for (int level = 0; level < zoom_config.depth; ++level) {
+        zoom_max_dim = std::max(zoom_max_dim, zoom_dim(zoom_config.keys_for(level)));
     }
 
-    XColor bright_color;
-    if (!XParseColor(display, cmap, "#FFFF00", &bright_color) || !XAllocColor(display, cmap, &bright_color)) {
-        std::cerr << "Failed to allocate bright yellow color, using white instead\n";
-        bright_pixel = WhitePixel(display, DefaultScreen(display));
-    } else {
-        bright_pixel = bright_color.pixel;
+    int screen = DefaultScreen(display);
+    unsigned long bright_pixel = rgb_pixel(bright_rgb, WhitePixel(display, screen), "bright yellow", "white");
+    unsigned long dark_pixel = rgb_pixel(dark_rgb, BlackPixel(display, screen), "dark", "black");
+    startup_phase_done("colors");
+
+    load_label_font();
+    backend = new X11Backend(display, label_font, label_xft_font);
+    backend->set_color(COLOR_BACKGROUND, 0, 0x000000);
+    backend->set_color(COLOR_LINE, WhitePixel(display, screen), 0xFFFFFF);
+    backend->set_color(COLOR_HIGHLIGHT, WhitePixel(display, screen), 0xFFFFFF);
+    backend->set_color(COLOR_LABEL, bright_pixel, bright_rgb);
+    backend->set_color(COLOR_SUBCELL_LABEL, dark_pixel, dark_rgb);
+    startup_phase_done("font");
+
+    // A replay must not depend on which windows happen to be open.
+    if (!replay_path.empty() && snap_to_windows) {
+        std::cerr << "Ignoring --snap while replaying\n";
+        snap_to_windows = false;
     }
 
-    XColor dark_color;
-    if (!XParseColor(display, cmap, "#333333", &dark_color) || !XAllocColor(display, cmap, &dark_color)) {
-        std::cerr << "Failed to allocate dark color, using black instead\n";
-        dark_pixel = BlackPixel(display, DefaultScreen(display));
-    } else {
-        dark_pixel = dark_color.pixel;
+    // Key grabs and the root's event mask go out as one batch. Interning the
+    // atoms is its only round trip: the replies come after any errors for
+    // the grabs, so all of those have been collected when it returns.
+    default_error_handler = XSetErrorHandler(grab_error_handler);
+    for (const std::string& name : chord_key_names) {
+        KeySym sym = XStringToKeysym(name.c_str());
+        KeyCode keycode = sym == NoSymbol ? 0 : XKeysymToKeycode(display, sym);
+        if (!keycode) {
+            fatal("Unknown chord key: " + name);
+        }
+        chord_keycodes.push_back(keycode);
+        grab_key_with_modifiers(display, root, keycode, ControlMask, name);
     }
+    (void)XSelectInput(display, root, KeyPressMask | KeyReleaseMask |
+                       (snap_to_windows ? SubstructureNotifyMask : NoEventMask));
+
+    char* atom_names[] = {(char*)"_NET_WM_WINDOW_OPACITY", (char*)"CARDINAL"};
+    Atom atoms[2];
+    XInternAtoms(display, atom_names, 2, False, atoms);
+    opacity_atom = atoms[0];
+    cardinal_atom = atoms[1];
+
+    XSetErrorHandler(default_error_handler);
+    for (const PendingGrab& grab : pending_grabs) {
+        if (grab.failed) {
+            std::cerr << "Warning: failed to grab " << grab.key << " with modifiers mask "
+                      << grab.modifiers << "\n";
+        }
+    }
+    pending_grabs.clear();
+    startup_phase_done("grabs");
 
-    unsigned int ctrl_mask = ControlMask;
+    // Without this, holding a key produces fake KeyRelease/KeyPress pairs.
+    if (!XkbSetDetectableAutoRepeat(display, True, nullptr)) {
+        std::cerr << "Detectable auto-repeat not supported, chord may retrigger while held\n";
+    }
 
-    keycode_h = XKeysymToKeycode(display, XK_h);
-    keycode_t = XKeysymToKeycode(display, XK_t);
+    int shape_event_base, shape_error_base;
+    if (shaped_overlay && !XShapeQueryExtension(display, &shape_event_base, &shape_error_base)) {
+        std::cerr << "Shape extension not available, ignoring --shaped\n";
+        shaped_overlay = false;
+    }
 
-    grab_key_with_modifiers(display, root, keycode_h, ctrl_mask);
-    grab_key_with_modifiers(display, root, keycode_t, ctrl_mask);
+    int randr_error_base;
+    if (XRRQueryExtension(display, &randr_event_base, &randr_error_base)) {
+        XRRSelectInput(display, root, RRScreenChangeNotifyMask);
+    } else {
+        randr_event_base = -1;
+        std::cerr << "XRandR not available, treating the screen as one monitor\n";
+    }
+    startup_phase_done("extensions");
 
-    (void)XSelectInput(display, root, KeyPressMask);
+    refresh_monitors();
+    startup_phase_done("monitors");
 
-    // Parse command‑line arguments for overlay timeout (seconds)
-    for (int i = 1; i < argc; ++i) {
-        if (std::string(argv[i]) == "--timeout" && i + 1 < argc) {
-            overlay_timeout_seconds = std::stoi(argv[i + 1]);
-            overlay_timeout_ms = overlay_timeout_seconds * 1000;
-            ++i; // skip the value we just consumed
+    if (snap_to_windows) {
+        snap_open(display, root);
+        startup_phase_done("snap");
+    }
+
+    // A replay uses the monitors and alphabet of the recording so IDs match.
+    SessionLog replay_log;
+    if (!replay_path.empty()) {
+        std::string error;
+        if (!read_session(replay_path, replay_log, error)) {
+            fatal("Replay: " + error);
         }
+        monitors = replay_log.monitors;
+        show_all_monitors = replay_log.all_monitors;
+        label_alphabet = replay_log.alphabet;
+        validate_label_alphabet();
+        build_layouts();
     }
 
-    std::signal(SIGINT, signal_handler);
-    while (keepRunning) {
-        // Check timeout before blocking for events
-        if (overlayVisible) {
-            auto now = std::chrono::steady_clock::now();
-            if (std::chrono::duration_cast<std::chrono::milliseconds>(now - overlay_start_time).count() > overlay_timeout_ms) {
-                hide_overlay_without_click();
-                // Continue to next iteration to avoid processing stale events
-                continue;
-            }
+    if (!record_path.empty()) {
+        record_file = std::fopen(record_path.c_str(), "w");
+        if (!record_file) {
+            fatal("Cannot open " + record_path + " for recording");
         }
+        write_session_header(record_file, monitors, show_all_monitors, label_alphabet);
+    }
 
-        // Process pending events if any; otherwise wait briefly
-        if (XPending(display)) {
-            XEvent ev;
-            XNextEvent(display, &ev);
+    overlay_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (overlay_timer_fd < 0) {
+        fatal("Failed to create overlay timer");
+    }
 
-            if (ev.type == KeyPress) {
-                XKeyEvent xkey = ev.xkey;
-                KeySym keysym = XLookupKeysym(&xkey, 0);
-
-                char keys_return[32];
-                XQueryKeymap(display, keys_return);
-
-                bool ctrl_held = (xkey.state & ctrl_mask) == ctrl_mask;
-                bool h_down = (keys_return[keycode_h / 8] & (1 << (keycode_h % 8))) != 0;
-                bool t_down = (keys_return[keycode_t / 8] & (1 << (keycode_t % 8))) != 0;
-
-                if (ctrl_held && h_down && t_down) {
-                    if (!toggle_in_progress) {
-                        overlayVisible = !overlayVisible;
-                        if (overlayVisible) {
-                            create_overlay();
-                            overlay_start_time = std::chrono::steady_clock::now();
-                        } else {
-                            destroy_overlay();
-                        }
-                        toggle_in_progress = true;
-                    }
-                } else {
-                    toggle_in_progress = false;
-                }
+    if (!control_socket_path.empty()) {
+        std::string error = control_open(control_socket_path);
+        if (!error.empty()) {
+            fatal("Control socket: " + error);
+        }
+    }
 
-                if (overlayVisible && ev.xkey.window == overlay) {
-                    // Change click mode with Ctrl+number
-                    if (ctrl_held) {
-                        if (keysym == XK_1) {
-                            current_click_mode = LEFT_CLICK;
-                            continue;
-                        } else if (keysym == XK_2) {
-                            current_click_mode = RIGHT_CLICK;
-                            continue;
-                        } else if (keysym == XK_3) {
-                            current_click_mode = MIDDLE_CLICK;
-                            continue;
-                        } else if (keysym == XK_4) {
-                            current_click_mode = DOUBLE_CLICK;
-                            continue;
-                        }
-                    }
+    // Pre-warm the overlays so a toggle is just a map request.
+    if (persistent_overlay) {
+        prewarm_overlays();
+        startup_phase_done("overlay");
+    }
 
-                    if (keysym == XK_Escape) {
-                        hide_overlay_without_click();
-                        continue;
-                    }
+    if (startup_profile) {
+        // Wait for the server to get through everything still queued, so its
+        // share of the startup cost is counted too.
+        XSync(display, False);
+        startup_phase_done("sync");
+        print_startup_profile();
+    }
 
-                    if ((keysym == XK_Return || keysym == XK_KP_Enter)) {
-                        int screen = DefaultScreen(display);
-                        int width = DisplayWidth(display, screen);
-                        int height = DisplayHeight(display, screen);
+    int exit_code = 0;
+    if (!replay_path.empty()) {
+        exit_code = replay_session(replay_log, replay_original_timing) ? 0 : 2;
+        keepRunning = 0;  // a replay does not go on into the interactive loop
+    }
 
-                        if (typed_chars.length() >= 2) {
-                            highlighted_subcell = "";
-                            draw_grid(overlay, width, height);
-                            move_pointer_to_cell(highlighted_cell, width, height);
-                        }
-                        destroy_overlay(true);
-                        continue;
-                    }
+    // SIGINT and SIGUSR1 stay blocked except while waiting in ppoll, so a
+    // signal can never slip in between the flag checks and going to sleep.
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGUSR1, dump_signal_handler);
+    sigset_t blocked, wait_mask;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &blocked, &wait_mask);
 
-                    char buf[32];
-                    int len = XLookupString(&xkey, buf, sizeof(buf), &keysym, nullptr);
-                    if (len == 1 && std::isalnum(buf[0])) {
-                        char c = std::tolower(buf[0]);
-                        typed_chars += c;
-                        if (typed_chars.length() > 3) {
-                            typed_chars = typed_chars.substr(typed_chars.length() - 3);
-                        }
+    auto loop_start_time = std::chrono::steady_clock::now();
 
-                        int screen = DefaultScreen(display);
-                        int width = DisplayWidth(display, screen);
-                        int height = DisplayHeight(display, screen);
-
-                        if (typed_chars.length() == 2) {
-                            highlighted_cell = typed_chars;
-                            highlighted_subcell = "";
-                            draw_grid(overlay, width, height);
-                            move_pointer_to_cell(highlighted_cell, width, height);
-                        } else if (typed_chars.length() == 3) {
-                            std::array<char, 9> subcell_keys = {'g', 'c', 'r', 'h', 't', 'n', 'm', 'w', 'v'};
-                            std::string subid;
-                            bool valid_subcell = false;
-                            for (char key : subcell_keys) {
-                                if (typed_chars[2] == key) {
-                                    subid += key;
-                                    valid_subcell = true;
-                                    break;
-                                }
-                            }
-
-                            if (valid_subcell) {
-                                highlighted_subcell = subid;
-                                draw_grid(overlay, width, height);
-                                move_pointer_to_subcell(highlighted_cell, highlighted_subcell, width, height);
-                                destroy_overlay(true);
-                            } else {
-                                typed_chars = typed_chars.substr(0, 2); // remove invalid char
-                            }
-                        }
-                    }
-                }
-            } else if (ev.type == Expose && overlayVisible) {
-                int screen = DefaultScreen(display);
-                int width = DisplayWidth(display, screen);
-                int height = DisplayHeight(display, screen);
-                draw_grid(overlay, width, height);
+    while (keepRunning) {
+        if (dump_requested) {
+            dump_requested = 0;
+            dump_stats(true);
+        }
+
+        // Drain everything Xlib has queued; XPending also flushes our output.
+        while (keepRunning && XPending(display)) {
+            XEvent ev;
+            {
+                TraceScope trace(TRACE_EVENT_DEQUEUE);
+                XNextEvent(display, &ev);
             }
-        } else {
-            // No events pending; sleep briefly to avoid busy loop
-            usleep(10000);
+            TraceScope trace(TRACE_HANDLE_EVENT);
+            log_input(ev);
+            handle_event(ev);
+            log_state();
+        }
+        if (!keepRunning) break;
+        present_frame();
+        prerender_while_idle();
+        // Pre-rendering stops when it finds input waiting, which it may
+        // already have read off the socket; handle that before sleeping.
+        if (XQLength(display) > 0) continue;
+
+        pollfd fds[64] = {
+            {ConnectionNumber(display), POLLIN, 0},
+            {overlay_timer_fd, POLLIN, 0},
+        };
+        int control_fds = control_poll_fds(fds + 2, 62);
+        // Sleep until input, the overlay timeout or the next queued pointer action.
+        int wait_ms = control_has_queued_events() ? 0 : ms_until_next_action();
+        timespec timeout = {wait_ms / 1000, (wait_ms % 1000) * 1000000L};
+        int ready = ppoll(fds, 2 + control_fds, wait_ms < 0 ? nullptr : &timeout, &wait_mask);
+        loop_stats.wakeups++;
+        if (ready < 0) {
+            if (errno != EINTR) {
+                fatal(std::string("poll failed: ") + std::strerror(errno));
+            }
+            loop_stats.idle_wakeups++;
+            continue;
+        }
+
+        if (ready == 0) {
+            loop_stats.action_wakeups++;
+        }
+        run_due_actions();
+        if (control_fds > 0) {
+            control_handle(fds + 2, control_fds, all_monitors_layout(), zoom_config,
+                           {press_duration_ms, double_click_interval_ms});
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(overlay_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                loop_stats.timer_wakeups++;
+                log_session('E', "timeout");
+                hide_overlay();
+                log_state();
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            loop_stats.x_wakeups++;
+        } else if (ready > 0 && !(fds[1].revents & POLLIN)) {
+            loop_stats.idle_wakeups++;
         }
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            fatal("Lost connection to X server");
+        }
+    }
+
+    if (report_wakeups) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loop_start_time).count();
+        std::cerr << "Wakeups: " << loop_stats.wakeups
+                  << " (X events " << loop_stats.x_wakeups
+                  << ", timeouts " << loop_stats.timer_wakeups
+                  << ", pointer actions " << loop_stats.action_wakeups
+                  << ", idle " << loop_stats.idle_wakeups
+                  << ") over " << seconds << " s\n";
     }
 
+    if (!stats_file_path.empty() || !trace_json_path.empty()) {
+        dump_stats(false);
+    }
+
+    release_held_buttons();
+    control_close();
+    if (record_file) {
+        std::fclose(record_file);
+    }
+    close(overlay_timer_fd);
+    free_overlay_resources();
+    delete backend;
+    backend = nullptr;
+    if (label_xft_font) {
+        XftFontClose(display, label_xft_font);
+    }
+    if (label_font) {
+        XFreeFontInfo(nullptr, label_font, 1);
+    }
     XCloseDisplay(display);
-    return 0;
+    return exit_code;
 }
@@ -0,0 +1,159 @@
+#include "render.h"
+#include "zoom.h"
+
+#include <algorithm>
+
+// Scratch buffers reused across calls so steady-state rendering allocates nothing.
+static std::vector<Segment> segment_scratch;
+static std::vector<TextItem> text_scratch;
+static std::vector<Rect> rect_scratch;
+
+Rect cell_rect(const GridCell& cell) {
+    return {cell.x, cell.y, grid_size, grid_size};
+}
+
+int label_baseline(RenderBackend& backend, int center_y) {
+    return center_y + (backend.text_ascent() - backend.text_descent()) / 2;
+}
+
+Rect label_rect(RenderBackend& backend, const GridCell& cell) {
+    int ascent = backend.text_ascent();
+    int descent = backend.text_descent();
+    if (ascent + descent == 0) return cell_rect(cell);
+    int w = backend.text_width(cell.label, cell.label_len);
+    int baseline = label_baseline(backend, cell.y + grid_size / 2);
+    return {cell.x + grid_size / 2 - w / 2, baseline - ascent, w, ascent + descent};
+}
+
+void render_base_grid(RenderBackend& backend, const GridLayout& layout, Surface target) {
+    Rect all = {0, 0, layout.width, layout.height};
+    backend.fill_rects(target, COLOR_BACKGROUND, &all, 1);
+
+    // Lines stop at the monitor edges so they never run into a neighbour.
+    segment_scratch.clear();
+    for (const GridBlock& block : layout.blocks) {
+        for (int c = 0; c < block.cols; ++c) {
+            int x = block.x + c * grid_size;
+            segment_scratch.push_back({x, block.y, x, block.y + block.height});
+        }
+        for (int r = 0; r < block.rows; ++r) {
+            int y = block.y + r * grid_size;
+            segment_scratch.push_back({block.x, y, block.x + block.width, y});
+        }
+    }
+    backend.draw_segments(target, COLOR_LINE, segment_scratch.data(), (int)segment_scratch.size());
+
+    // Labels all share one color; cells are stored row by row.
+    for (const GridBlock& block : layout.blocks) {
+        for (int r = 0; r < block.rows; ++r) {
+            text_scratch.clear();
+            for (int c = 0; c < block.cols; ++c) {
+                const GridCell& cell = layout.cells[block.first_cell + r * block.cols + c];
+                int w = backend.text_width(cell.label, cell.label_len);
+                text_scratch.push_back({cell.label, cell.label_len, cell.x + grid_size / 2 - w / 2});
+            }
+            if (!text_scratch.empty()) {
+                backend.draw_text_row(target, COLOR_LABEL,
+                                      label_baseline(backend, block.y + r * grid_size + grid_size / 2),
+                                      text_scratch.data(), (int)text_scratch.size());
+            }
+        }
+    }
+}
+
+static int legend_cell_size(RenderBackend& backend) {
+    int text_height = backend.text_ascent() + backend.text_descent();
+    return text_height > 0 ? text_height + 4 : 16;
+}
+
+bool zoom_labels_fit(RenderBackend& backend, const Rect& region, int dim) {
+    int text_height = backend.text_ascent() + backend.text_descent();
+    return region.height / dim >= text_height + 2 && region.width / dim >= text_height / 2 + 2;
+}
+
+Rect zoom_legend_rect(RenderBackend& backend, const GridLayout& layout, const GridCell& cell, int dim) {
+    int size = dim * legend_cell_size(backend);
+    int x = cell.x + grid_size + 2;
+    if (x + size > layout.width) x = cell.x - 2 - size;
+    int y = std::max(0, std::min(cell.y, layout.height - size));
+    return {x, y, size, size};
+}
+
+// One text row per grid row, each key centred in its part.
+static void draw_zoom_keys(RenderBackend& backend, Surface target, const Rect& area,
+                           const char* keys, int dim) {
+    TextItem items[max_zoom_dim];
+    for (int row = 0; row < dim; ++row) {
+        int count = 0;
+        int baseline = 0;
+        for (int col = 0; col < dim; ++col) {
+            Rect part = zoom_part(area, dim, row * dim + col);
+            const char* key = &keys[row * dim + col];
+            items[count++] = {key, 1, part.x + part.width / 2 - backend.text_width(key, 1) / 2};
+            baseline = label_baseline(backend, part.y + part.height / 2);
+        }
+        backend.draw_text_row(target, COLOR_SUBCELL_LABEL, baseline, items, count);
+    }
+}
+
+// At the first level the region is the whole cell: its label and the key
+// labels are drawn on the white fill, and grid lines, being white as well,
+// need no drawing. Deeper levels outline the region and its parts instead.
+void render_highlighted_cell(RenderBackend& backend, const GridLayout& layout, Surface target,
+                             int cell_index, const ZoomView& view) {
+    const GridCell& cell = layout.cells[cell_index];
+
+    Rect fill = cell_rect(cell);
+    backend.fill_rects(target, COLOR_HIGHLIGHT, &fill, 1);
+
+    const Rect& r = view.region;
+    bool first_level = r.x == fill.x && r.y == fill.y && r.width == fill.width && r.height == fill.height;
+    if (first_level) {
+        TextItem label = {cell.label, cell.label_len,
+                          cell.x + grid_size / 2 - backend.text_width(cell.label, cell.label_len) / 2};
+        backend.draw_text_row(target, COLOR_LABEL, label_baseline(backend, cell.y + grid_size / 2),
+                              &label, 1);
+    } else {
+        Segment lines[2 * (max_zoom_dim + 1)];
+        int n = 0;
+        for (int i = 0; i <= view.dim; ++i) {
+            int x = i == view.dim ? r.x + r.width - 1 : zoom_part(r, view.dim, i).x;
+            int y = i == view.dim ? r.y + r.height - 1 : zoom_part(r, view.dim, i * view.dim).y;
+            lines[n++] = {x, r.y, x, r.y + r.height - 1};
+            lines[n++] = {r.x, y, r.x + r.width - 1, y};
+        }
+        backend.draw_segments(target, COLOR_SUBCELL_LABEL, lines, n);
+    }
+
+    if (view.legend.width == 0) {
+        draw_zoom_keys(backend, target, r, view.keys, view.dim);
+    } else {
+        backend.fill_rects(target, COLOR_HIGHLIGHT, &view.legend, 1);
+        int size = view.dim * legend_cell_size(backend);
+        draw_zoom_keys(backend, target, {view.legend.x, view.legend.y, size, size}, view.keys, view.dim);
+    }
+}
+
+void render_dimmed_cells(RenderBackend& backend, const GridLayout& layout, Surface target,
+                         const std::vector<int>& cell_indices) {
+    if (cell_indices.empty()) return;
+
+    rect_scratch.clear();
+    for (int i : cell_indices) {
+        const GridCell& cell = layout.cells[i];
+        rect_scratch.push_back({cell.x + 1, cell.y + 1, grid_size - 1, grid_size - 1});
+    }
+    backend.fill_rects(target, COLOR_BACKGROUND, rect_scratch.data(), (int)rect_scratch.size());
+}
+
+void trimmed_candidates(const GridLayout& layout, int old_node, int new_node,
+                        std::vector<int>& out) {
+    int old_first = layout.node_first[old_node];
+    int old_end = old_first + layout.node_count[old_node];
+    int new_first = layout.node_first[new_node];
+    int new_end = new_first + layout.node_count[new_node];
+
+    out.clear();
+    for (int i = old_first; i < new_first; ++i) out.push_back(i);
+    for (int i = new_end; i < old_end; ++i) out.push_back(i);
+}
@@ -0,0 +1,98 @@
+#ifndef STRIX_RENDER_H
+#define STRIX_RENDER_H
+
+#include "grid.h"
+
+#include <vector>
+
+struct Rect {
+    int x, y;
+    int width, height;
+};
+
+struct Segment {
+    int x1, y1, x2, y2;
+};
+
+// One label of a text row; x is the absolute start of the label.
+struct TextItem {
+    const char* chars;
+    int len;
+    int x;
+};
+
+enum Color {
+    COLOR_BACKGROUND,     // window background, also used to dim cells
+    COLOR_LINE,           // grid lines
+    COLOR_HIGHLIGHT,      // fill of the highlighted cell
+    COLOR_LABEL,          // cell labels
+    COLOR_SUBCELL_LABEL,  // subcell labels inside the highlighted cell
+    COLOR_COUNT
+};
+
+// SURFACE_GRID holds the unhighlighted grid and is the source for repaints of
+// SURFACE_WINDOW, the surface the user sees.
+enum Surface { SURFACE_GRID, SURFACE_WINDOW };
+
+// Everything the grid drawing code needs from a display. Calls are shaped
+// like batched X requests: one call per color and primitive type.
+class RenderBackend {
+public:
+    virtual ~RenderBackend() {}
+
+    virtual int text_width(const char* text, int len) = 0;
+    virtual int text_ascent() = 0;
+    virtual int text_descent() = 0;
+
+    virtual void fill_rects(Surface target, Color color, const Rect* rects, int count) = 0;
+    virtual void draw_segments(Surface target, Color color, const Segment* segments, int count) = 0;
+    // Labels sharing one baseline, left to right.
+    virtual void draw_text_row(Surface target, Color color, int baseline,
+                               const TextItem* items, int count) = 0;
+    virtual void copy_area(Surface from, Surface to, const Rect& area) = 0;
+};
+
+Rect cell_rect(const GridCell& cell);
+
+// Box covering a cell's label, or the whole cell when no font metrics exist.
+Rect label_rect(RenderBackend& backend, const GridCell& cell);
+
+// Baseline that vertically centers a label on center_y.
+int label_baseline(RenderBackend& backend, int center_y);
+
+// Background, all lines in one call and one text row per grid row.
+void render_base_grid(RenderBackend& backend, const GridLayout& layout, Surface target);
+
+// What the highlighted cell shows. region is the part of the cell being
+// refined (the cell itself at the first level), split dim x dim and keyed row
+// by row by keys. When the parts are too small for labels, the keys go into
+// legend, a key map beside the cell; legend is empty otherwise.
+struct ZoomView {
+    Rect region;
+    const char* keys;
+    int dim;
+    Rect legend;
+};
+
+// Whether labels fit inside the parts of region split dim x dim.
+bool zoom_labels_fit(RenderBackend& backend, const Rect& region, int dim);
+
+// Key map position for levels up to dim x dim: beside the cell, on the right
+// unless that leaves the layout.
+Rect zoom_legend_rect(RenderBackend& backend, const GridLayout& layout, const GridCell& cell, int dim);
+
+// White fill and label of the highlighted cell, with the current refinement
+// level drawn on top.
+void render_highlighted_cell(RenderBackend& backend, const GridLayout& layout, Surface target,
+                             int cell_index, const ZoomView& view);
+
+// Blank the inside of cells, keeping their grid lines.
+void render_dimmed_cells(RenderBackend& backend, const GridLayout& layout, Surface target,
+                         const std::vector<int>& cell_indices);
+
+// Cells that stop being candidates when typing moves from old_node to its
+// child new_node: the two ends trimmed off the contiguous candidate range.
+void trimmed_candidates(const GridLayout& layout, int old_node, int new_node,
+                        std::vector<int>& out);
+
+#endif
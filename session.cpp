@@ -0,0 +1,153 @@
+#include "session.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+static const char session_magic[] = "# strix session v1";
+
+bool read_session(const std::string& path, SessionLog& log, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(in, line) || line != session_magic) {
+        error = path + " is not a strix session log";
+        return false;
+    }
+
+    int line_no = 1;
+    while (std::getline(in, line)) {
+        ++line_no;
+        if (line.empty()) continue;
+        std::istringstream words(line);
+        std::string kind;
+        words >> kind;
+        if (kind == "monitors") {
+            std::string mode, rect;
+            words >> mode;
+            log.all_monitors = mode == "all";
+            while (words >> rect) {
+                Monitor m;
+                if (std::sscanf(rect.c_str(), "%d,%d,%d,%d", &m.x, &m.y, &m.width, &m.height) != 4) {
+                    error = "bad monitor on line " + std::to_string(line_no);
+                    return false;
+                }
+                log.monitors.push_back(m);
+            }
+        } else if (kind == "alphabet") {
+            words >> log.alphabet;
+        } else if (kind == "E" || kind == "S" || kind == "A") {
+            SessionEntry entry;
+            entry.kind = kind[0];
+            if (!(words >> entry.t_ns)) {
+                error = "bad timestamp on line " + std::to_string(line_no);
+                return false;
+            }
+            std::getline(words >> std::ws, entry.body);
+            log.entries.push_back(entry);
+        } else {
+            error = "unknown entry on line " + std::to_string(line_no);
+            return false;
+        }
+    }
+    if (log.monitors.empty() || log.alphabet.empty()) {
+        error = path + " has no monitors or alphabet header";
+        return false;
+    }
+    return true;
+}
+
+void write_session_header(FILE* f, const std::vector<Monitor>& monitors, bool all_monitors,
+                          const std::string& alphabet) {
+    std::fprintf(f, "%s\nmonitors %s", session_magic, all_monitors ? "all" : "current");
+    for (const Monitor& m : monitors) {
+        std::fprintf(f, " %d,%d,%d,%d", m.x, m.y, m.width, m.height);
+    }
+    std::fprintf(f, "\nalphabet %s\n", alphabet.c_str());
+}
+
+void write_session_entry(FILE* f, const SessionEntry& entry) {
+    std::fprintf(f, "%c %llu %s\n", entry.kind, (unsigned long long)entry.t_ns, entry.body.c_str());
+}
+
+// Bodies of entries of one kind, in order.
+static std::vector<const SessionEntry*> entries_of(const std::vector<SessionEntry>& entries, char kind) {
+    std::vector<const SessionEntry*> out;
+    for (const SessionEntry& e : entries) {
+        if (e.kind == kind) out.push_back(&e);
+    }
+    return out;
+}
+
+// Time from each action back to the input that caused it.
+static std::vector<double> action_latencies_us(const std::vector<SessionEntry>& entries) {
+    std::vector<double> out;
+    uint64_t last_event = 0;
+    bool seen_event = false;
+    for (const SessionEntry& e : entries) {
+        if (e.kind == 'E') {
+            last_event = e.t_ns;
+            seen_event = true;
+        } else if (e.kind == 'A' && seen_event) {
+            out.push_back((e.t_ns - last_event) / 1e3);
+        }
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+static bool compare_kind(const char* what, const std::vector<SessionEntry>& original,
+                         const std::vector<SessionEntry>& replayed, char kind, std::ostream& out) {
+    std::vector<const SessionEntry*> a = entries_of(original, kind);
+    std::vector<const SessionEntry*> b = entries_of(replayed, kind);
+    size_t common = std::min(a.size(), b.size());
+    for (size_t i = 0; i < common; ++i) {
+        if (a[i]->body != b[i]->body) {
+            out << what << " differ at #" << i + 1 << ": recorded '" << a[i]->body
+                << "', replayed '" << b[i]->body << "'\n";
+            return false;
+        }
+    }
+    if (a.size() != b.size()) {
+        out << what << " differ in count: recorded " << a.size() << ", replayed " << b.size() << "\n";
+        return false;
+    }
+    out << what << " match (" << a.size() << ")\n";
+    return true;
+}
+
+static void print_latencies(const char* label, const std::vector<double>& us, std::ostream& out) {
+    out << std::left << std::setw(10) << label << std::right;
+    if (us.empty()) {
+        out << "no actions\n";
+        return;
+    }
+    auto pct = [&](double p) { return us[std::min(us.size() - 1, (size_t)(p * us.size()))]; };
+    out << std::fixed << std::setprecision(1)
+        << "input to action p50 " << pct(0.50) << " us, p99 " << pct(0.99)
+        << " us, max " << us.back() << " us\n";
+    out.unsetf(std::ios::fixed);
+}
+
+bool compare_sessions(const SessionLog& original, const std::vector<SessionEntry>& replayed,
+                      double replay_seconds, std::ostream& out) {
+    size_t events = entries_of(original.entries, 'E').size();
+    double recorded_seconds = 0;
+    if (!original.entries.empty()) {
+        recorded_seconds = (original.entries.back().t_ns - original.entries.front().t_ns) / 1e9;
+    }
+    out << "Replayed " << events << " inputs in " << replay_seconds << " s ("
+        << (replay_seconds > 0 ? events / replay_seconds : 0) << " inputs/s); recorded session took "
+        << recorded_seconds << " s\n";
+
+    bool states = compare_kind("States", original.entries, replayed, 'S', out);
+    bool actions = compare_kind("Actions", original.entries, replayed, 'A', out);
+    print_latencies("recorded", action_latencies_us(original.entries), out);
+    print_latencies("replayed", action_latencies_us(replayed), out);
+    return states && actions;
+}
@@ -0,0 +1,49 @@
+#ifndef STRIX_SESSION_H
+#define STRIX_SESSION_H
+
+#include "grid.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A session log is a text file: a header with the monitor layout and
+// alphabet, then one line per entry:
+//
+//   E <ns> key <press> <keycode> <keysym> <state> <x_root> <y_root> <to_overlay>
+//   E <ns> timeout
+//   S <ns> <visible> <typed_chars|-> <highlighted_cell> <highlighted_subcell> <click_mode>
+//   A <ns> warp <x> <y> | press <button> | release <button> | map | unmap
+//
+// E lines are input the main loop handled, S lines the state after an input
+// whenever it changed, A lines the X requests that had a visible effect.
+// Times are monotonic nanoseconds since the program started.
+struct SessionEntry {
+    char kind;       // 'E', 'S' or 'A'
+    uint64_t t_ns;
+    std::string body;
+};
+
+struct SessionLog {
+    std::vector<Monitor> monitors;
+    bool all_monitors = true;
+    std::string alphabet;
+    std::vector<SessionEntry> entries;
+};
+
+bool read_session(const std::string& path, SessionLog& log, std::string& error);
+
+// Write the header; entries follow with write_session_entry.
+void write_session_header(FILE* f, const std::vector<Monitor>& monitors, bool all_monitors,
+                          const std::string& alphabet);
+void write_session_entry(FILE* f, const SessionEntry& entry);
+
+// Compare the state and action sequences of a replay with the original log
+// and print throughput and input-to-action latency for both. Returns true if
+// the sequences match.
+bool compare_sessions(const SessionLog& original, const std::vector<SessionEntry>& replayed,
+                      double replay_seconds, std::ostream& out);
+
+#endif
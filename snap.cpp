@@ -0,0 +1,276 @@
+#include "snap.h"
+
+#include <X11/Xproto.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+struct TrackedWindow {
+    Window parent;       // root, or the top-level window this is a child of
+    int x, y;            // outer corner, relative to the parent's inside
+    int width, height;   // inside the border
+    int border;
+    bool mapped;
+    std::vector<Window> children;  // top-level windows only
+    int bucket;          // bucket its centre is filed in, -1 if not indexed
+};
+
+struct SnapEntry {
+    Window window;
+    int x, y;            // centre in root coordinates
+};
+
+static Display* snap_display = nullptr;
+static Window snap_root = 0;
+static std::unordered_map<Window, TrackedWindow> windows;
+
+// Cells are 50 px, so a cell or any zoom region covers at most four buckets.
+static const int bucket_size = 64;
+static int index_width = 0, index_height = 0;
+static int bucket_cols = 0, bucket_rows = 0;
+static std::vector<std::vector<SnapEntry>> buckets;
+
+static XErrorHandler previous_error_handler = nullptr;
+
+// A tracked window can be destroyed before a request about it reaches the
+// server. The resulting BadWindow errors are expected; anything else goes to
+// the handler that was installed before.
+static int snap_error_handler(Display* d, XErrorEvent* e) {
+    if (e->error_code == BadWindow &&
+        (e->request_code == X_ChangeWindowAttributes || e->request_code == X_GetWindowAttributes ||
+         e->request_code == X_QueryTree)) {
+        return 0;
+    }
+    return previous_error_handler ? previous_error_handler(d, e) : 0;
+}
+
+static void unindex(Window id, TrackedWindow& w) {
+    if (w.bucket == -1) return;
+    std::vector<SnapEntry>& bucket = buckets[w.bucket];
+    for (size_t i = 0; i < bucket.size(); ++i) {
+        if (bucket[i].window == id) {
+            bucket[i] = bucket.back();
+            bucket.pop_back();
+            break;
+        }
+    }
+    w.bucket = -1;
+}
+
+// File a window under the bucket of its centre if it is visible on screen.
+static void reindex(Window id) {
+    auto it = windows.find(id);
+    if (it == windows.end()) return;
+    TrackedWindow& w = it->second;
+    unindex(id, w);
+
+    bool visible = w.mapped;
+    int x = w.x, y = w.y;
+    if (w.parent != snap_root) {
+        auto parent = windows.find(w.parent);
+        if (parent == windows.end()) return;
+        const TrackedWindow& p = parent->second;
+        visible = visible && p.mapped;
+        x += p.x + p.border;
+        y += p.y + p.border;
+    }
+    if (!visible || w.width <= 0 || w.height <= 0) return;
+
+    int cx = x + w.border + w.width / 2;
+    int cy = y + w.border + w.height / 2;
+    if (cx < 0 || cy < 0 || cx >= index_width || cy >= index_height) return;
+    w.bucket = (cy / bucket_size) * bucket_cols + cx / bucket_size;
+    buckets[w.bucket].push_back({id, cx, cy});
+}
+
+// Reindex a window and, since they move with it, its children.
+static void reindex_tree(Window id) {
+    reindex(id);
+    auto it = windows.find(id);
+    if (it == windows.end()) return;
+    for (Window child : it->second.children) reindex(child);
+}
+
+static void untrack(Window id) {
+    auto it = windows.find(id);
+    if (it == windows.end()) return;
+    unindex(id, it->second);
+    Window parent = it->second.parent;
+    std::vector<Window> children = std::move(it->second.children);
+    windows.erase(it);
+
+    for (Window child : children) untrack(child);
+    if (parent != snap_root) {
+        auto p = windows.find(parent);
+        if (p != windows.end()) {
+            std::vector<Window>& siblings = p->second.children;
+            siblings.erase(std::remove(siblings.begin(), siblings.end(), id), siblings.end());
+        }
+    }
+}
+
+static void track(Window id, Window parent, int x, int y, int width, int height, int border,
+                  bool mapped, bool override_redirect) {
+    if (parent != snap_root) {
+        // Only children of top-level windows are tracked, not deeper ones.
+        auto p = windows.find(parent);
+        if (p == windows.end() || p->second.parent != snap_root) return;
+        p->second.children.push_back(id);
+    } else if (!override_redirect) {
+        // XSelectInput replaces this client's mask on the window, which would
+        // clobber the overlay's own; menus, tooltips and the overlay are all
+        // override-redirect and rarely have children worth tracking anyway.
+        XSelectInput(snap_display, id, SubstructureNotifyMask);
+    }
+    windows[id] = {parent, x, y, width, height, border, mapped, {}, -1};
+    reindex(id);
+}
+
+// Track the children of parent, and theirs if parent is root.
+static void walk(Window parent) {
+    Window root_return, parent_return;
+    Window* children = nullptr;
+    unsigned int count = 0;
+    if (!XQueryTree(snap_display, parent, &root_return, &parent_return, &children, &count)) return;
+    for (unsigned int i = 0; i < count; ++i) {
+        XWindowAttributes attrs;
+        if (!XGetWindowAttributes(snap_display, children[i], &attrs) || attrs.c_class == InputOnly) {
+            continue;
+        }
+        track(children[i], parent, attrs.x, attrs.y, attrs.width, attrs.height, attrs.border_width,
+              attrs.map_state != IsUnmapped, attrs.override_redirect);
+        if (parent == snap_root && !attrs.override_redirect) walk(children[i]);
+    }
+    if (children) XFree(children);
+}
+
+void snap_open(Display* display, Window root) {
+    snap_display = display;
+    snap_root = root;
+    previous_error_handler = XSetErrorHandler(snap_error_handler);
+
+    int screen = DefaultScreen(display);
+    snap_resize(DisplayWidth(display, screen), DisplayHeight(display, screen));
+    walk(root);
+}
+
+void snap_resize(int width, int height) {
+    index_width = width;
+    index_height = height;
+    bucket_cols = (width + bucket_size - 1) / bucket_size;
+    bucket_rows = (height + bucket_size - 1) / bucket_size;
+    buckets.assign(bucket_cols * bucket_rows, {});
+    for (auto& entry : windows) entry.second.bucket = -1;
+    for (auto& entry : windows) reindex(entry.first);
+}
+
+bool snap_handle_event(const XEvent& ev) {
+    switch (ev.type) {
+        case CreateNotify: {
+            const XCreateWindowEvent& e = ev.xcreatewindow;
+            // Windows created while snap_open walked the tree were seen there.
+            if (!windows.count(e.window)) {
+                track(e.window, e.parent, e.x, e.y, e.width, e.height, e.border_width, false,
+                      e.override_redirect);
+            }
+            return true;
+        }
+        case DestroyNotify:
+            untrack(ev.xdestroywindow.window);
+            return true;
+        case ConfigureNotify: {
+            const XConfigureEvent& e = ev.xconfigure;
+            auto it = windows.find(e.window);
+            if (it != windows.end()) {
+                it->second.x = e.x;
+                it->second.y = e.y;
+                it->second.width = e.width;
+                it->second.height = e.height;
+                it->second.border = e.border_width;
+                reindex_tree(e.window);
+            }
+            return true;
+        }
+        case GravityNotify: {
+            auto it = windows.find(ev.xgravity.window);
+            if (it != windows.end()) {
+                it->second.x = ev.xgravity.x;
+                it->second.y = ev.xgravity.y;
+                reindex_tree(ev.xgravity.window);
+            }
+            return true;
+        }
+        case MapNotify:
+        case UnmapNotify: {
+            Window id = ev.type == MapNotify ? ev.xmap.window : ev.xunmap.window;
+            auto it = windows.find(id);
+            if (it != windows.end()) {
+                it->second.mapped = ev.type == MapNotify;
+                reindex_tree(id);
+            }
+            return true;
+        }
+        case ReparentNotify: {
+            // Sent via both the old and the new parent; the second copy finds
+            // the window already moved.
+            const XReparentEvent& e = ev.xreparent;
+            auto it = windows.find(e.window);
+            if (it != windows.end() && it->second.parent == e.parent) return true;
+
+            int width, height, border;
+            bool mapped;
+            if (it != windows.end()) {
+                width = it->second.width;
+                height = it->second.height;
+                border = it->second.border;
+                mapped = it->second.mapped;
+                if (it->second.parent == snap_root && e.parent != snap_root) {
+                    XSelectInput(snap_display, e.window, NoEventMask);
+                }
+                untrack(e.window);
+            } else {
+                // Moved up from a level that is not tracked; rare enough for a round trip.
+                XWindowAttributes attrs;
+                if (!XGetWindowAttributes(snap_display, e.window, &attrs)) return true;
+                width = attrs.width;
+                height = attrs.height;
+                border = attrs.border_width;
+                mapped = attrs.map_state != IsUnmapped;
+            }
+            track(e.window, e.parent, e.x, e.y, width, height, border, mapped, e.override_redirect);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool snap_point(const Rect& region, Window exclude, int& x, int& y) {
+    if (buckets.empty()) return false;
+    int cx = region.x + region.width / 2;
+    int cy = region.y + region.height / 2;
+    int col0 = std::max(0, region.x / bucket_size);
+    int row0 = std::max(0, region.y / bucket_size);
+    int col1 = std::min(bucket_cols - 1, (region.x + region.width - 1) / bucket_size);
+    int row1 = std::min(bucket_rows - 1, (region.y + region.height - 1) / bucket_size);
+
+    long best = -1;
+    for (int row = row0; row <= row1; ++row) {
+        for (int col = col0; col <= col1; ++col) {
+            for (const SnapEntry& e : buckets[row * bucket_cols + col]) {
+                if (e.window == exclude || e.x < region.x || e.x >= region.x + region.width ||
+                    e.y < region.y || e.y >= region.y + region.height) {
+                    continue;
+                }
+                long dx = e.x - cx, dy = e.y - cy;
+                long distance = dx * dx + dy * dy;
+                if (best == -1 || distance < best) {
+                    best = distance;
+                    x = e.x;
+                    y = e.y;
+                }
+            }
+        }
+    }
+    return best != -1;
+}
@@ -0,0 +1,31 @@
+#ifndef STRIX_SNAP_H
+#define STRIX_SNAP_H
+
+#include "render.h"
+
+#include <X11/Xlib.h>
+
+// Window geometry for --snap: top-level windows and their direct children,
+// kept up to date from SubstructureNotify events instead of being queried
+// when the overlay shows. Window centres are bucketed on a coarse grid so a
+// lookup only touches the buckets under the selected region.
+
+// Walk the window tree once and start tracking. The caller must already have
+// selected SubstructureNotifyMask on root, so nothing created during the walk
+// is missed.
+void snap_open(Display* display, Window root);
+
+// Resize the bucket grid after the screen size changed.
+void snap_resize(int width, int height);
+
+// Update the index from a CreateNotify, DestroyNotify, ConfigureNotify,
+// GravityNotify, MapNotify, UnmapNotify or ReparentNotify. Returns false for
+// any other event.
+bool snap_handle_event(const XEvent& ev);
+
+// Centre of the mapped window, other than exclude, whose centre lies inside
+// region (root coordinates) and is nearest to the region's centre. Returns
+// false if there is none.
+bool snap_point(const Rect& region, Window exclude, int& x, int& y);
+
+#endif
@@ -0,0 +1,133 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <memory>
+
+LatencyHistogram trace_histograms[TRACE_STAGE_COUNT];
+
+static const char* const stage_names[TRACE_STAGE_COUNT] = {
+    "event_dequeue", "handle_event", "chord", "create_overlay", "draw_grid",
+    "draw_update", "present", "prerender", "warp", "click", "x_flush",
+};
+
+const char* trace_stage_name(TraceStage stage) {
+    return stage_names[stage];
+}
+
+int LatencyHistogram::bucket_of(uint64_t ns) {
+    if (ns < (uint64_t)sub_buckets) return (int)ns;
+    int exp = 63 - __builtin_clzll(ns);  // >= 3
+    int sub = (int)((ns >> (exp - 3)) & (sub_buckets - 1));
+    int bucket = (exp - 2) * sub_buckets + sub;
+    return bucket < bucket_count ? bucket : bucket_count - 1;
+}
+
+uint64_t LatencyHistogram::bucket_limit(int bucket) {
+    if (bucket < sub_buckets) return (uint64_t)bucket;
+    int exp = bucket / sub_buckets + 2;
+    int sub = bucket % sub_buckets;
+    return ((uint64_t)(sub_buckets + sub + 1) << (exp - 3)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    buckets_[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t seen = max_.load(std::memory_order_relaxed);
+    while (ns > seen && !max_.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::quantile(double q) const {
+    uint64_t total = count();
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (total - 1)) + 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < bucket_count; ++b) {
+        seen += buckets_[b].load(std::memory_order_relaxed);
+        if (seen >= rank) return std::min(bucket_limit(b), max());
+    }
+    return max();
+}
+
+static const auto trace_epoch = std::chrono::steady_clock::now();
+
+uint64_t trace_now() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - trace_epoch).count();
+}
+
+// Ring of the most recent spans; only allocated with --trace-json.
+struct TraceSpan {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    TraceStage stage;
+};
+
+static const size_t span_capacity = 1 << 16;
+static std::unique_ptr<TraceSpan[]> spans;
+static std::atomic<uint64_t> span_next{0};
+
+void trace_enable_spans() {
+    if (!spans) spans.reset(new TraceSpan[span_capacity]);
+}
+
+void trace_record(TraceStage stage, uint64_t start_ns, uint64_t end_ns) {
+    trace_histograms[stage].record(end_ns - start_ns);
+    if (spans) {
+        uint64_t slot = span_next.fetch_add(1, std::memory_order_relaxed);
+        spans[slot % span_capacity] = {start_ns, end_ns, stage};
+    }
+}
+
+static std::string format_ns(uint64_t ns) {
+    char buf[32];
+    if (ns < 10000) {
+        std::snprintf(buf, sizeof(buf), "%llu ns", (unsigned long long)ns);
+    } else if (ns < 10000000) {
+        std::snprintf(buf, sizeof(buf), "%.1f us", ns / 1e3);
+    } else {
+        std::snprintf(buf, sizeof(buf), "%.1f ms", ns / 1e6);
+    }
+    return buf;
+}
+
+void trace_dump(std::ostream& out) {
+    out << std::left << std::setw(16) << "stage" << std::right
+        << std::setw(10) << "count" << std::setw(12) << "mean"
+        << std::setw(12) << "p50" << std::setw(12) << "p99" << std::setw(12) << "max" << "\n";
+    for (int s = 0; s < TRACE_STAGE_COUNT; ++s) {
+        const LatencyHistogram& h = trace_histograms[s];
+        uint64_t n = h.count();
+        out << std::left << std::setw(16) << stage_names[s] << std::right << std::setw(10) << n;
+        if (n == 0) {
+            out << "\n";
+            continue;
+        }
+        out << std::setw(12) << format_ns(h.sum() / n)
+            << std::setw(12) << format_ns(h.quantile(0.50))
+            << std::setw(12) << format_ns(h.quantile(0.99))
+            << std::setw(12) << format_ns(h.max()) << "\n";
+    }
+    out.flush();
+}
+
+bool trace_write_chrome_json(const std::string& path) {
+    if (!spans) return false;
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) return false;
+
+    uint64_t end = span_next.load(std::memory_order_relaxed);
+    uint64_t begin = end > span_capacity ? end - span_capacity : 0;
+    std::fprintf(f, "{\"traceEvents\":[\n");
+    for (uint64_t i = begin; i < end; ++i) {
+        const TraceSpan& span = spans[i % span_capacity];
+        std::fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}\n",
+                     i == begin ? "" : ",", stage_names[span.stage],
+                     span.start_ns / 1e3, (span.end_ns - span.start_ns) / 1e3);
+    }
+    std::fprintf(f, "],\"displayTimeUnit\":\"ns\"}\n");
+    return std::fclose(f) == 0;
+}
@@ -0,0 +1,81 @@
+#ifndef STRIX_TRACE_H
+#define STRIX_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Hot-path stages that are timed on every pass.
+enum TraceStage {
+    TRACE_EVENT_DEQUEUE,   // XNextEvent
+    TRACE_HANDLE_EVENT,    // whole handle_event call
+    TRACE_CHORD,           // chord detection on a key press
+    TRACE_CREATE_OVERLAY,  // window, GC and grid pixmap creation
+    TRACE_DRAW_GRID,       // rendering the base grid
+    TRACE_DRAW_UPDATE,     // dimming and highlight repaints while typing
+    TRACE_PRESENT,         // copying a finished frame to the overlay window
+    TRACE_PRERENDER,       // rendering highlight images ahead of time while idle
+    TRACE_WARP,            // XWarpPointer
+    TRACE_CLICK,           // XTest button press or release
+    TRACE_X_FLUSH,         // writing queued requests to the server
+    TRACE_STAGE_COUNT
+};
+
+const char* trace_stage_name(TraceStage stage);
+
+// Fixed-size latency histogram with 8 linear sub-buckets per power of two,
+// so any recorded value is reported within 12.5%. Updates are relaxed atomic
+// increments: no locks and no allocation.
+class LatencyHistogram {
+public:
+    static const int sub_buckets = 8;
+    static const int bucket_count = 8 + 40 * sub_buckets;  // up to 2^43 ns, about 2.4 hours
+
+    void record(uint64_t ns);
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the given quantile (0..1).
+    uint64_t quantile(double q) const;
+
+private:
+    static int bucket_of(uint64_t ns);
+    static uint64_t bucket_limit(int bucket);
+
+    std::atomic<uint64_t> buckets_[bucket_count] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+extern LatencyHistogram trace_histograms[TRACE_STAGE_COUNT];
+
+// Nanoseconds on the monotonic clock since the program started.
+uint64_t trace_now();
+
+// Keep the last completed spans for a Chrome trace (--trace-json).
+void trace_enable_spans();
+void trace_record(TraceStage stage, uint64_t start_ns, uint64_t end_ns);
+
+// Table of count, mean, p50, p99 and max per stage.
+void trace_dump(std::ostream& out);
+// Buffered spans in Chrome trace event format (chrome://tracing, Perfetto).
+bool trace_write_chrome_json(const std::string& path);
+
+// Times the enclosing scope into a stage.
+class TraceScope {
+public:
+    explicit TraceScope(TraceStage stage) : stage_(stage), start_(trace_now()) {}
+    ~TraceScope() { trace_record(stage_, start_, trace_now()); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    TraceStage stage_;
+    uint64_t start_;
+};
+
+#endif
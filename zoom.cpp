@@ -0,0 +1,75 @@
+#include "zoom.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+
+std::string check_zoom_keys(const std::string& keys) {
+    std::bitset<256> seen;
+    for (char c : keys) {
+        unsigned char uc = (unsigned char)c;
+        if (!std::isalnum(uc) || std::isupper(uc) || seen.test(uc)) {
+            return "use distinct lowercase letters and digits";
+        }
+        seen.set(uc);
+    }
+    int dim = zoom_dim(keys);
+    if (dim < 2 || dim * dim != (int)keys.size()) {
+        return "each level needs a square number of keys (4, 9, 16, ...)";
+    }
+    return "";
+}
+
+int zoom_dim(const std::string& keys) {
+    int dim = 1;
+    while ((dim + 1) * (dim + 1) <= (int)keys.size()) ++dim;
+    return dim;
+}
+
+int zoom_key_index(const std::string& keys, char c) {
+    size_t pos = keys.find(c);
+    return pos == std::string::npos ? -1 : (int)pos;
+}
+
+Rect zoom_part(const Rect& region, int dim, int index) {
+    int col = index % dim;
+    int row = index / dim;
+    int x0 = region.x + col * region.width / dim;
+    int x1 = region.x + (col + 1) * region.width / dim;
+    int y0 = region.y + row * region.height / dim;
+    int y1 = region.y + (row + 1) * region.height / dim;
+    return {x0, y0, x1 - x0, y1 - y0};
+}
+
+bool zoom_can_split(const Rect& region, int dim) {
+    return region.width >= dim && region.height >= dim;
+}
+
+int auto_zoom_depth(const ZoomConfig& config, double px_per_mm) {
+    // 6 px at 96 DPI, shrinking with density down to 2 px.
+    double dpi = px_per_mm * 25.4;
+    double target_px = std::max(2.0, 6.0 * 96 / dpi);
+    int size = grid_size;
+    int depth = 0;
+    while (size > target_px) {
+        int dim = zoom_dim(config.keys_for(depth));
+        if (size < dim) break;
+        size /= dim;
+        ++depth;
+    }
+    return depth > 0 ? depth : 1;
+}
+
+bool zoom_path_region(const ZoomConfig& config, const Rect& cell, const std::string& path, Rect& out) {
+    if ((int)path.size() > config.depth) return false;
+    Rect region = cell;
+    for (size_t level = 0; level < path.size(); ++level) {
+        const std::string& keys = config.keys_for((int)level);
+        int index = zoom_key_index(keys, path[level]);
+        int dim = zoom_dim(keys);
+        if (index == -1 || !zoom_can_split(region, dim)) return false;
+        region = zoom_part(region, dim, index);
+    }
+    out = region;
+    return true;
+}
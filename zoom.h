@@ -0,0 +1,51 @@
+#ifndef STRIX_ZOOM_H
+#define STRIX_ZOOM_H
+
+#include "render.h"
+
+#include <string>
+#include <vector>
+
+// Keys of the default refinement level: a 3x3 grid on the Dvorak home row.
+const char default_zoom_keys[] = "gcrhtnmwv";
+
+// 36 distinct letters and digits allow at most a 6x6 level.
+const int max_zoom_dim = 6;
+
+// How a selected cell is refined (--zoom-keys, --zoom-depth). Each level
+// splits the current region into a square grid keyed row by row by that
+// level's keys; the last key set repeats for deeper levels.
+struct ZoomConfig {
+    std::vector<std::string> keys = {default_zoom_keys};
+    int depth = 1;  // levels after the cell
+
+    const std::string& keys_for(int level) const {
+        return keys[(size_t)level < keys.size() ? level : keys.size() - 1];
+    }
+};
+
+// Why keys cannot key a level, or an empty string if they can.
+std::string check_zoom_keys(const std::string& keys);
+
+// Side length of the grid keys lay out (3 for 9 keys).
+int zoom_dim(const std::string& keys);
+
+// Position of c in keys, or -1.
+int zoom_key_index(const std::string& keys, char c);
+
+// Part index of region split into dim x dim; parts share the remainder pixels.
+Rect zoom_part(const Rect& region, int dim, int index);
+
+// Whether every part of region split dim x dim is at least one pixel.
+bool zoom_can_split(const Rect& region, int dim);
+
+// Smallest depth whose final parts are a few pixels wide, given the screen's
+// pixels per millimetre, without splitting below single pixels. The target
+// shrinks as density grows, so denser screens get more levels, not fewer.
+int auto_zoom_depth(const ZoomConfig& config, double px_per_mm);
+
+// Region reached from cell by typing path, one key per level. Returns false
+// if a key is not valid at its level or the path is deeper than the config.
+bool zoom_path_region(const ZoomConfig& config, const Rect& cell, const std::string& path, Rect& out);
+
+#endif